@@ -0,0 +1,44 @@
+/*
+ * backup_sram.h - Access to the 4kB backup SRAM
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef BACKUP_SRAM_H_
+#define BACKUP_SRAM_H_
+
+#include "stm32f4xx.h"
+
+// Layout of the backup SRAM:
+// 0x000 handoff.h block, rewritten before every jump to the application
+// 0x100 telemetry.h ring, kept across resets
+
+static inline void init_backup_sram(void){
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+	PWR->CR |= PWR_CR_DBP;					//allow writes to the backup domain
+	RCC->AHB1ENR |= RCC_AHB1ENR_BKPSRAMEN;
+}
+
+#endif /* BACKUP_SRAM_H_ */
@@ -38,8 +38,11 @@
 
 //#include "../stm-audio-bootloader/qpsk/packet_decoder.h"
 //#include "../stm-audio-bootloader/qpsk/demodulator.h"
-#include "../stm-audio-bootloader/fsk/packet_decoder.h"
-#include "../stm-audio-bootloader/fsk/demodulator.h"
+#include "fsk/packet_decoder.h"
+#include "fsk/demodulator.h"
+#include "fsk/band_pass_filter.h"
+#include "flash_map.h"
+#include "flash_image.h"
 
 extern "C" {
 #include <stddef.h> /* size_t */
@@ -47,6 +50,15 @@ extern "C" {
 #include "codec.h"
 #include "i2s.h"
 #include "pca9685_driver.h"
+#include "led_ring.h"
+#include "cycle_counter.h"
+#include "hw_crc.h"
+#include "flash_ram.h"
+#include "clock_profile.h"
+#include "ramfunc.h"
+#include "handoff.h"
+#include "stream_header.h"
+#include "telemetry.h"
 
 #define delay(x)						\
 do {							\
@@ -67,12 +79,36 @@ using namespace stmlib;
 using namespace stm_audio_bootloader;
 
 
-const float kSampleRate = 48000.0;
+//Codec capture rate, set with make SAMPLE_RATE=96000. Symbol lengths are in samples,
+//so at 96kHz the same files (encoded with -s 96000) take half the time.
+#ifndef SAMPLE_RATE
+#define SAMPLE_RATE 48000
+#endif
+const float kSampleRate = SAMPLE_RATE;
+
+//Core clock from the start of audio capture to the end of the copy, see clock_profile.h.
+//make CLOCK_BOOST=1 runs at 180MHz, for heavier demodulators and a faster copy/verify.
+//While waiting on the button after an error, the clock is divided down to CLOCK_PROFILE_IDLE.
+#ifndef CLOCK_BOOST
+#define CLOCK_BOOST 0
+#endif
+const ClockProfile kReceiveProfile = CLOCK_BOOST ? CLOCK_PROFILE_FAST : CLOCK_PROFILE_NORMAL;
+
+//make CLOCK_BENCHMARK=1 measures the audio interrupt and packet decoder load at each profile
+//when update mode is entered, before the codec is started, see BenchmarkClockProfiles()
+#ifndef CLOCK_BENCHMARK
+#define CLOCK_BENCHMARK 0
+#endif
+const uint8_t kBenchPauses = 16;		//Ahead of the preamble, the rate detection needs 4
+const int16_t kBenchLevel = 8192;		//ADC counts, the AGC target
+static_assert(NUM_CLOCK_PROFILES == HANDOFF_NUM_CLOCK_PROFILES, "clock_bench[] must have one entry per ClockProfile");
+
+//FSK symbol lengths, in samples between slicer transitions: the demodulators pick one of
+//kSymbolRates (fsk/demodulator.h) from the first preamble
 //const float kModulationRate = 6000.0; //QPSK 6000
 //const float kBitRate = 12000.0; //QPSK 12000
-uint32_t kStartExecutionAddress =		0x08008000;
-uint32_t kStartReceiveAddress = 		0x08080000;
-uint32_t EndOfMemory =					0x080FFFFC;
+
+//Flash layout (FLASH_SIZE, sector map, image info record): see flash_map.h
 
 extern "C" {
 
@@ -86,15 +122,75 @@ void DebugMon_Handler(void) { }
 void PendSV_Handler(void) { }
 
 }
+
+//CPU-only data goes in CCM RAM (zeroed at startup, see stm32f427.ld), where the CPU doesn't share
+//the bus with the audio DMA. The DMA buffers (i2s.c) and code must stay in main SRAM.
+//make CCM_DATA=0 leaves them in main SRAM (the stack stays in CCM), to compare the decode cycles
+#ifndef CCM_DATA
+#define CCM_DATA 1
+#endif
+#if CCM_DATA
+#define CCMBSS __attribute__((section(".ccmbss")))
+#else
+#define CCMBSS
+#endif
+
 System sys;
-PacketDecoder decoder;
-Demodulator demodulator;
+//One FSK receiver per codec channel, see STREAM_FLAG_STEREO
+const uint8_t kNumChannels = 2;
+const uint8_t kLeftChannel = 0;
+const uint8_t kRightChannel = 1;
+PacketDecoder decoders[kNumChannels] CCMBSS;
+Demodulator demodulators[kNumChannels] CCMBSS;
+
+//make PREFILTER=1 runs each channel through a band-pass (fsk/band_pass_filter.h) before the slicer
+#ifndef PREFILTER
+#define PREFILTER 0
+#endif
+#if PREFILTER
+BandPassFilter prefilters[kNumChannels] CCMBSS;
+#endif
 
 uint16_t packet_index;
-uint16_t old_packet_index=0;
-uint8_t slider_i=0;
 
 bool g_error;
+bool app_valid;
+
+//Stats passed to the application in backup SRAM, see handoff.h
+//reset_to_jump_cycles: the cycle counter is started in Reset_Handler, so this includes the .data/.bss init
+//and SystemInit(), which run at 16MHz (HSI) until the PLL is up
+BootloaderHandoff handoff;
+
+//The telemetry ring follows the handoff in backup SRAM
+static_assert(sizeof(BootloaderHandoff) <= TELEMETRY_OFFSET, "BootloaderHandoff overlaps the telemetry ring");
+
+//Cycles spent in process_audio_block() (slicer and demodulators), per call.
+//The average is a running mean << 8, so it needs no division in the interrupt.
+volatile uint32_t audio_cycles_max;
+volatile uint32_t audio_cycles_avg;
+//The part of it spent in the two prefilters (PREFILTER builds only, 0 otherwise), the same way.
+//It includes the cycle counter reads around Process(), a few cycles per channel.
+volatile uint32_t prefilter_cycles_max;
+volatile uint32_t prefilter_cycles_avg;
+
+//The audio interrupt runs from SRAM (see ramfunc.h), so the vector table is copied there:
+//reading its vector from flash would hold it off during an erase as much as running from flash.
+#define NUM_VECTORS 98 //g_pfnVectors in startup_stm32f4xx.s
+extern "C" const uint32_t g_pfnVectors[];
+uint32_t ram_vectors[128] __attribute__((aligned(512)));
+
+//ROTARY_SW must read the same for this long to be believed
+#define BUTTON_DEBOUNCE_CYCLES (CYCLES_PER_MS/2)
+
+//After startup, the button must still be held (or released) for this long to stay in (or leave) update mode,
+//so a tap at power-up or a bounce isn't taken as a request to update
+#define BUTTON_HOLD_CYCLES (CYCLES_PER_MS*300)
+
+//LED ring sweep, played from SysTick while the receiver is already listening
+#define RING_STARTUP_TRAIL 8
+#define RING_STARTUP_LEN (77+RING_STARTUP_TRAIL)
+#define RING_STARTUP_STEP_MS 8
+uint8_t ring_startup_pos=RING_STARTUP_LEN;
 
 enum UiState {
   UI_STATE_WAITING,
@@ -104,59 +200,189 @@ enum UiState {
 };
 volatile UiState ui_state;
 
+//Running stats of the slicer output, updated by process_audio_block()
+//envelope: peak input level, in ADC counts
+//jitter: mean distance of the slicer run lengths from the nearest symbol length, in 1/16 samples
+//margin: mean distance of the run lengths from the nearest decision threshold, in 1/16 samples
+//runs: run lengths measured so far, if it stops counting there is no signal (or a steady tone)
+struct LinkQuality {
+	uint16_t envelope;
+	uint16_t jitter;
+	uint16_t margin;
+	uint32_t runs;
+};
+volatile LinkQuality link_quality;
+
+//Automatic gain control: while waiting for the first packet (the intro and the preamble), the codec's
+//line input gain is stepped until the envelope is within an octave of kAgcTarget. The slicer thresholds
+//are a few hundred counts, so quiet sources are lifted well clear of them and hot ones are kept off the
+//clip point. The gain is held while receiving, and kept for the next attempt.
+const uint16_t kAgcTarget = 8192;			//ADC counts, -12dBFS
+const uint16_t kAgcSilence = 32;			//No signal below this, the gain is left alone
+const uint32_t kAgcIntervalMs = 100;		//The envelope takes ~40ms to fall after a step down
+uint8_t input_gain = CODEC_INPUT_GAIN_0dB;	//As loaded by Codec_Init()
+uint32_t agc_last_ms;
+
+
+//Update phases, shown on slider LEDs 1-4
+enum UpdatePhase {
+  PHASE_NONE,
+  PHASE_ERASE,
+  PHASE_RECEIVE,
+  PHASE_VERIFY,
+  PHASE_COPY
+};
+volatile UpdatePhase update_phase;
+
+//Total image length from the stream header, 0 if not known
+uint32_t expected_length;
+
+StreamHeader stream_header;
+bool stream_header_received;
+
+//Stereo streams: even packets are on the left channel, odd ones on the right
+bool stereo;
+uint16_t channel_packets[kNumChannels];
+
+//Level/quality and progress display on the LED ring
+#define DISPLAY_REFRESH_MS 32
+#define PROGRESS_BRIGHTNESS 500
+#define LEVEL_BAR_OFFSET 9
+#define LEVEL_BAR_CLIP_LEDS 2
+
 extern "C" {
 
+//A word at a time when both ends are word aligned (the stream header, and the block buffer slots)
+typedef uint32_t __attribute__((__may_alias__)) aliased_word;
+
 inline void *memcpy(void *dest, const void *src, size_t n)
 {
     char *dp = (char *)dest;
     const char *sp = (const char *)src;
+
+    if (!(((uintptr_t)dp | (uintptr_t)sp) & 3)) {
+        for (; n >= 4; n -= 4, dp += 4, sp += 4)
+            *(aliased_word *)dp = *(const aliased_word *)sp;
+    }
     while (n--)
         *dp++ = *sp++;
     return dest;
 }
 
 
-void update_slider_LEDs(void){
-	static uint16_t dly=0;
-	uint16_t fade_speed=800;
+uint8_t link_margin_percent(void){
+	uint16_t margin = link_quality.margin;
+	const Demodulator& d = demodulators[kLeftChannel];
+	//Best possible margin: half the distance between the one and zero symbol lengths, in 1/16 samples
+	uint16_t ideal_margin = ((d.one_period() - d.zero_period()) / 2) << 4;
 
-	if (ui_state == UI_STATE_RECEIVING){
-		if (packet_index>old_packet_index){
-			old_packet_index=packet_index;
-			LED_SLIDER_OFF(ALL_SLIDERS);
-			LED_SLIDER_ON(slider_led[slider_i]);
-			if (++slider_i>=6) slider_i=0;
+	return margin >= ideal_margin ? 100 : (margin * 100) / ideal_margin;
+}
 
-			//FSK only?
+//One LED per half-bit of input level: 8 LEDs is just above the slicer threshold, 17 is -6dBFS,
+//the top LEVEL_BAR_CLIP_LEDS are close to clipping
+uint8_t level_bar_length(uint16_t envelope){
+	uint8_t msb, half_bits;
 
-			if (((packet_index/6) % (78*2) )<78)
-				LEDDriver_set_one_LED((packet_index/6) % 78, 500);
-			else
-				LEDDriver_set_one_LED((packet_index/6) % 78, 0);
+	if (envelope < 2) return 0;
 
-		}
-	} else if (ui_state == UI_STATE_WRITING){
+	msb = 31 - __builtin_clz(envelope);
+	half_bits = msb*2 + ((envelope >> (msb-1)) & 1);
 
-		if (dly++>400){
-			dly=0;
-			LED_SLIDER_OFF(ALL_SLIDERS);
-		} else if (dly==200){
-			LED_SLIDER_ON(ALL_SLIDERS);
+	if (half_bits <= LEVEL_BAR_OFFSET) return 0;
+	half_bits -= LEVEL_BAR_OFFSET;
+	return half_bits > LEDRING_NUM_RING_LEDS ? LEDRING_NUM_RING_LEDS : half_bits;
+}
+
+//Ring: input level (only while waiting, the ring shows progress while receiving)
+//Channel LEDs: symbol decision margin
+//Colored green/yellow/red by the margin, or blue when no FSK symbols are coming in
+void update_link_LEDs(void){
+	static uint32_t last_runs=0;
+	static uint8_t blink=0;
+	uint32_t runs = link_quality.runs;
+	uint8_t quality = link_margin_percent();
+	uint8_t i, bar, quality_bar;
+	uint16_t r, g, b;
+
+	if (runs == last_runs){
+		r=0; g=0; b=300;
+		quality_bar=0;
+	} else {
+		if (quality >= 75) 		{r=0; g=500; b=0;}
+		else if (quality >= 40) {r=400; g=300; b=0;}
+		else 					{r=500; g=0; b=0;}
+		quality_bar = (quality * 6 + 50) / 100;
+	}
+	last_runs = runs;
+
+	if (ui_state == UI_STATE_WAITING){
+		bar = level_bar_length(link_quality.envelope);
+		for (i=0;i<LEDRING_NUM_RING_LEDS;i++){
+			if (i >= bar)											LEDRing_SetRGB(i, 0, 0, 0);
+			else if (i >= LEDRING_NUM_RING_LEDS-LEVEL_BAR_CLIP_LEDS)	LEDRing_SetRGB(i, 500, 0, 0);
+			else													LEDRing_SetRGB(i, r, g, b);
 		}
 
-	} else if (ui_state == UI_STATE_WAITING){
+		//Nothing to show: blink the first LED so it's clear we're listening
+		if (!bar){
+			if (++blink >= 24) blink=0;
+			LEDRing_SetRGB(0, 0, 0, blink<12 ? 300 : 0);
+		}
+	}
 
-		if (dly==(fade_speed>>1)){ 		LEDDriver_set_one_LED(1, 500);LEDDriver_set_one_LED(2, 0);}
-		if (dly++==fade_speed) {dly=0;	LEDDriver_set_one_LED(1, 0);LEDDriver_set_one_LED(2, 500);}
+	for (i=0;i<6;i++){
+		if (i < quality_bar)	LEDRing_SetRGB(LEDRING_NUM_RING_LEDS+i, r, g, b);
+		else					LEDRing_SetRGB(LEDRING_NUM_RING_LEDS+i, 0, 0, 0);
+	}
+}
 
+//Ring: fraction of expected_length received, filling the ring elements in order (the last one fades in).
+//Without a length from the stream header, a sweep that only shows packets are coming in.
+void update_progress_LEDs(void){
+	const uint32_t num_elements = LEDRING_NUM_RING_LEDS*3;
+	uint32_t received = packet_index * kPacketSize;
+	uint32_t fill, i;
+
+	if (expected_length){
+		if (received > expected_length) received = expected_length;
+		fill = (received * num_elements * 16) / expected_length; //in 1/16 elements, no overflow below 4MB
+
+		for (i=0;i<num_elements;i++){
+			if (i < fill/16)		LEDRing_Set(i, PROGRESS_BRIGHTNESS);
+			else if (i == fill/16)	LEDRing_Set(i, (fill % 16) * PROGRESS_BRIGHTNESS / 16);
+			else					LEDRing_Set(i, 0);
+		}
+	} else {
+		fill = (packet_index/6) % (num_elements*2);
 
-		//FSK only (needs to be optimized for QPSK)
-		/*
-		LEDDriver_set_one_LED(0, dly>fade_speed/2 ? dly : fade_speed-dly);
-		LEDDriver_set_one_LED(1, dly>fade_speed/2 ? fade_speed-dly: dly);
-		*/
+		for (i=0;i<num_elements;i++){
+			if (fill < num_elements)	LEDRing_Set(i, i <= fill ? PROGRESS_BRIGHTNESS : 0);
+			else						LEDRing_Set(i, i > fill-num_elements ? PROGRESS_BRIGHTNESS : 0);
+		}
 	}
+}
 
+//Called from SysTick: redraws the ring every DISPLAY_REFRESH_MS
+void update_slider_LEDs(void){
+	static uint8_t dly=0;
+
+	if (++dly < DISPLAY_REFRESH_MS) return;
+	dly=0;
+
+	if (ui_state == UI_STATE_RECEIVING || ui_state == UI_STATE_WRITING)
+		update_progress_LEDs();
+
+	if (ui_state == UI_STATE_WAITING || ui_state == UI_STATE_RECEIVING)
+		update_link_LEDs();
+}
+
+//The slider LED of the current phase is on. Written right away, since SysTick stalls while the flash is erased.
+void set_update_phase(UpdatePhase phase){
+	update_phase = phase;
+	LED_SLIDER_OFF(ALL_SLIDERS);
+	if (phase != PHASE_NONE)
+		LED_SLIDER_ON(slider_led[phase - 1]);
 }
 
 uint16_t State=0;
@@ -176,19 +402,49 @@ void check_button(void){
 		manual_exit_primed=1;
 
 	if (State == 0xe00f){ 				 //Depressed event (released followed by a bunch of depressed)
-		if (packet_index==0 && manual_exit_primed==1)
+		if (packet_index==0 && manual_exit_primed==1 && app_valid)
 			exit_updater=1;
 	}
 
 }
 
+void LED_ring_startup_step(void){
+	static uint8_t dly=0;
+
+	if (++dly < RING_STARTUP_STEP_MS) return;
+	dly=0;
+
+	if (ring_startup_pos<77) LEDRing_Set(ring_startup_pos, 500);
+	if (ring_startup_pos>=RING_STARTUP_TRAIL) LEDRing_Set(ring_startup_pos-RING_STARTUP_TRAIL, 0);
+	ring_startup_pos++;
+}
+
+//Time-based debounce: returns 1 once ROTARY_SW has read pressed for `cycles` in a row,
+//or 0 once it has read released for `cycles` in a row.
+uint8_t debounce_button(uint32_t cycles){
+	uint32_t start = CYCLES;
+	uint8_t state = ROTARY_SW ? 1 : 0;
+
+	while ((CYCLES - start) < cycles){
+		if ((ROTARY_SW ? 1 : 0) != state){
+			state = !state;
+			start = CYCLES;
+		}
+	}
+	return state;
+}
+
 void SysTick_Handler() {
 	system_clock.Tick();  // Tick global ms counter.
-	update_slider_LEDs();
+	if (ring_startup_pos < RING_STARTUP_LEN)
+		LED_ring_startup_step();
+	else
+		update_slider_LEDs();
+	LEDRing_Flush();
 	check_button();
 }
 
-uint16_t discard_samples = 8000;
+uint16_t discard_samples = SAMPLE_RATE / 6;
 
 /*
 void TIM4_IRQHandler(void)
@@ -216,17 +472,63 @@ void TIM4_IRQHandler(void)
 }
 */
 
-void process_audio_block(int16_t *input, int16_t *output, uint16_t ht, uint16_t size){
+//Updates link_quality with the length of one run of the slicer output.
+//Until the rate has been found, runs are measured against the default rate.
+RAMFUNC static inline void measure_run(uint16_t run){
+	static int32_t jitter=0, margin=0;
+	const Demodulator& d = demodulators[kLeftChannel];
+	const uint16_t pause_one = (d.pause_period() + d.one_period()) >> 1;
+	const uint16_t one_zero = (d.one_period() + d.zero_period()) >> 1;
+	uint16_t nominal, m;
+
+	if (run > d.pause_period()*2) return; //silence or a gap, not a symbol
+
+	if (run <= one_zero){
+		nominal = d.zero_period();
+		m = one_zero - run;
+	} else if (run <= pause_one){
+		nominal = d.one_period();
+		m = (run - one_zero) < (pause_one - run) ? (run - one_zero) : (pause_one - run);
+	} else {
+		nominal = d.pause_period();
+		m = run - pause_one;
+	}
+
+	//1/16 IIR, in 1/16 samples
+	jitter += (((int32_t)(run > nominal ? run - nominal : nominal - run) << 4) - jitter) >> 4;
+	margin += (((int32_t)m << 4) - margin) >> 4;
+
+	link_quality.jitter = jitter;
+	link_quality.margin = margin;
+	link_quality.runs++;
+}
+
+//Called from the audio DMA interrupt. Runs from SRAM, see ramfunc.h
+RAMFUNC void process_audio_block(int16_t *input, int16_t *output, uint16_t ht, uint16_t size){
 	bool sample;
 	static bool last_sample=false;
+	static uint16_t run_length=0;
+	static uint32_t envelope=0; //ADC counts << 8
+	static bool last_sample_right=false;
 	int32_t t;
+	uint32_t a;
+	uint32_t start = CYCLES;
+#if PREFILTER
+	uint32_t prefilter_start, prefilter_cycles = 0;
+#endif
 
-	LED_ON(LED_LOCK[5]);
+	LED_ON(LED_LOCK6);
 
 	while (size) {
 		size-=4;
 
+#if PREFILTER
+		prefilter_start = CYCLES;
+		t=prefilters[kLeftChannel].Process(input[0]);
+		prefilter_cycles += CYCLES - prefilter_start;
+#else
 		t=*input;
+#endif
 
 		if (last_sample==true){
 			if (t < -300)
@@ -239,14 +541,39 @@ void process_audio_block(int16_t *input, int16_t *output, uint16_t ht, uint16_t
 			else
 				sample=false;
 		}
+
+		if (run_length < 0xFF) run_length++;
+		if (sample != last_sample){
+			measure_run(run_length);
+			run_length=0;
+		}
 		last_sample=sample;
 
+		//Peak envelope, decays with a ~40ms time constant
+		a = (t < 0 ? -t : t) << 8;
+		if (a > envelope) envelope = a;
+		else envelope -= envelope >> (SAMPLE_RATE > 48000 ? 12 : 11);
+
 
 		if (sample) LOCKJACK_ON;
 		else LOCKJACK_OFF;
 
+		//Right channel, only used by stereo streams
+#if PREFILTER
+		prefilter_start = CYCLES;
+		t=prefilters[kRightChannel].Process(input[2]);
+		prefilter_cycles += CYCLES - prefilter_start;
+#else
+		t=input[2];
+#endif
+		if (last_sample_right)
+			last_sample_right = (t >= -300);
+		else
+			last_sample_right = (t > 400);
+
 		if (!discard_samples) {
-			demodulator.PushSample(sample);
+			demodulators[kLeftChannel].PushSample(sample);
+			demodulators[kRightChannel].PushSample(last_sample_right);
 		} else {
 			--discard_samples;
 		}
@@ -254,7 +581,7 @@ void process_audio_block(int16_t *input, int16_t *output, uint16_t ht, uint16_t
 		if (ui_state == UI_STATE_ERROR)
 			*output++=0;
 		else
-			*output++=*input;
+			*output++=input[0];
 		*output++=0;
 		*output++=0;
 		*output++=0;
@@ -265,122 +592,300 @@ void process_audio_block(int16_t *input, int16_t *output, uint16_t ht, uint16_t
 		*input++;
 
 	}
-	LED_OFF(LED_LOCK[5]);
+	link_quality.envelope = envelope >> 8;
+
+	LED_OFF(LED_LOCK6);
+
+	start = CYCLES - start;
+	if (start > audio_cycles_max) audio_cycles_max = start;
+	audio_cycles_avg += start - (audio_cycles_avg >> 8);
+#if PREFILTER
+	if (prefilter_cycles > prefilter_cycles_max) prefilter_cycles_max = prefilter_cycles;
+	prefilter_cycles_avg += prefilter_cycles - (prefilter_cycles_avg >> 8);
+#endif
 
 }
 
 
 }
 
-static uint32_t current_address;
-static uint32_t kSectorBaseAddress[] = {
-  0x08000000,
-  0x08004000,
-  0x08008000,
-  0x0800C000,
-  0x08010000,
-  0x08020000,
-  0x08040000,
-  0x08060000,
-  0x08080000,
-  0x080A0000,
-  0x080C0000,
-  0x080E0000
-};
-const uint32_t kBlockSize = 16384;
 const uint16_t kPacketsPerBlock = kBlockSize / kPacketSize;
-uint8_t recv_buffer[kBlockSize];
-
 
-inline void CopyMemory(uint32_t src_addr, uint32_t dst_addr, size_t size) {
+#ifndef STREAM_COMMIT
+#define STREAM_COMMIT 0
+#endif
+
+//Packets are collected into blocks and each block is written in the page gap that follows it.
+//With STREAM_COMMIT, each packet is written as soon as it's received, in stream order: the buffer
+//only has to hold a packet per channel, plus one that arrived ahead of the other channel's.
+#if STREAM_COMMIT
+const uint16_t kBufferPackets = 4;
+#else
+const uint16_t kBufferPackets = kPacketsPerBlock;
+#endif
+uint8_t recv_buffer[kBufferPackets * kPacketSize] CCMBSS __attribute__((aligned(4)));
+
+//STREAM_COMMIT: packets written so far, and the buffer slots holding packets waiting for an earlier one
+uint32_t committed_packets;
+uint8_t ready_slots;
+
+//STREAM_COMMIT can't take sparse streams: a record could skip past the sectors erased in the last
+//gap, and the erase would then hold up the main loop in the middle of a page (see EraseAhead())
+#if STREAM_COMMIT
+const uint32_t kSupportedStreamFlags = STREAM_SUPPORTED_FLAGS & ~STREAM_FLAG_SPARSE;
+#else
+const uint32_t kSupportedStreamFlags = STREAM_SUPPORTED_FLAGS;
+#endif
+
+//Erases and writes (flash_image.cc) on the lock LEDs, and receive sector erases as an update phase
+void ShowFlashBusy(FlashJob job, uint8_t sector, bool busy) {
+	static UpdatePhase phase;
+
+	switch (job) {
+		case FLASH_JOB_ERASE:
+			if (busy) {
+				phase = update_phase;
+				set_update_phase(PHASE_ERASE);
+			} else {
+				set_update_phase(phase);
+			}
+			break;
 
-	FLASH_Unlock();
-	FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
-				  FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR|FLASH_FLAG_PGSERR);
+		case FLASH_JOB_PROGRAM:
+			if (busy) LED_ON(LED_LOCK[4]);
+			else LED_OFF(LED_LOCK[4]);
+			break;
 
+		case FLASH_JOB_COPY_ERASE:
+			if (busy) LED_ON(LED_LOCK[sector % 6]);
+			else LED_OFF(LED_LOCK[sector % 6]);
+			break;
+	}
+}
 
-	for (size_t written = 0; written < size; written += 4) {
+//Stream position of the next packet from channel ch
+uint32_t NextPacket(uint8_t ch) {
+	return stereo ? channel_packets[ch] * 2 + ch : packet_index;
+}
 
-		//check if dst_addr is the start of a sector (in which case we should erase the sector)
-		for (int32_t i = 0; i < 12; ++i) {
-			if (dst_addr == kSectorBaseAddress[i]) {
-				LED_ON(LED_LOCK[i % 6]);
-				FLASH_EraseSector(i * 8, VoltageRange_3);
-				LED_OFF(LED_LOCK[i % 6]);
-			}
-		}
+//Place of the next packet from channel ch in the block buffer: the decoder writes it there directly.
+uint8_t* NextSlot(uint8_t ch) {
+	return recv_buffer + (NextPacket(ch) % kBufferPackets) * kPacketSize;
+}
 
-		//Boundary check
-		if (dst_addr > (kStartReceiveAddress-4)) //Do not overwrite receive buffer
-			break;
+uint16_t ProgramData(const uint8_t* data, size_t size) {
+	uint16_t result;
 
-		//Program the word
-		FLASH_ProgramWord(dst_addr, *(uint32_t*)src_addr);
+	if (stream_header_received && (stream_header.flags & STREAM_FLAG_SPARSE))
+		result = ProgramSparseBlock(data, size, stream_header.length);
+	else
+		result = ProgramPage(data, size);
 
-		src_addr += 4;
-		dst_addr += 4;
+	if (result != TLM_OK) {
+		ui_state = UI_STATE_ERROR;
+		g_error = true;
 	}
+	return result;
+}
+
+//STREAM_COMMIT: erases the sectors the next block will be written to. Packets are written as soon
+//as they arrive, so this is done in the gap before the block: when reception starts, after the header
+//and after each block.
+void EraseAhead() {
+	uint32_t program_start = system_clock.milliseconds();
 
+	FlashRAM_Unlock();
+	EraseSectorsBefore(current_address + kBlockSize);
+
+	handoff.program_ms += system_clock.milliseconds() - program_start;
 }
 
+//STREAM_COMMIT: writes the packets that are next in stream order
+uint16_t CommitPackets() {
+	uint32_t program_start = system_clock.milliseconds();
+	uint16_t result = TLM_OK;
+	uint16_t slot = committed_packets % kBufferPackets;
+
+	while (result == TLM_OK && (ready_slots & (1 << slot))) {
+		result = ProgramData(recv_buffer + slot * kPacketSize, kPacketSize);
+		ready_slots &= ~(1 << slot);
+		committed_packets++;
+		slot = committed_packets % kBufferPackets;
+	}
 
-inline void ProgramPage(const uint8_t* data, size_t size) {
-	LED_ON(LED_LOCK[4]);
+	handoff.program_ms += system_clock.milliseconds() - program_start;
+	return result;
+}
 
-	FLASH_Unlock();
-	FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
-				  FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR|FLASH_FLAG_PGSERR);
-	for (int32_t i = 0; i < 12; ++i) {
-		if (current_address == kSectorBaseAddress[i]) {
-		  FLASH_EraseSector(i * 8, VoltageRange_3);
-		}
+//Restarts packet reception on all channels, after the header or a block.
+//The demodulators are left alone: the audio interrupt ran on meanwhile, so their timing is still good
+//and the symbols they queued are the start of the next packets.
+void SyncReceivers() {
+	for (uint8_t ch = 0; ch < kNumChannels; ch++) {
+		decoders[ch].Reset();
+		decoders[ch].set_packet_buffer(NextSlot(ch));
 	}
-	const uint32_t* words = static_cast<const uint32_t*>(static_cast<const void*>(data));
-	for (size_t written = 0; written < size; written += 4) {
-		FLASH_ProgramWord(current_address, *words++);
-		current_address += 4;
-		if (current_address>=EndOfMemory){
-			ui_state = UI_STATE_ERROR;
-			g_error=true;
-			break;
-		}
+}
+
+//Counts a good packet from channel ch, which the decoder has already put in its slot (see NextSlot()).
+//In stereo, neither channel can get into the next block before the other one has finished this one.
+uint16_t StorePacket(uint8_t ch) {
+#if STREAM_COMMIT
+	ready_slots |= 1 << (NextPacket(ch) % kBufferPackets);
+#endif
+
+	if (stereo) {
+		if (channel_packets[ch] >= (packet_index / kPacketsPerBlock + 1) * (kPacketsPerBlock / 2))
+			return TLM_SYNC_ERROR;
+		channel_packets[ch]++;
 	}
 
-	LED_OFF(LED_LOCK[4]);
+	++packet_index;
+
+#if STREAM_COMMIT
+	//The channel's next packet needs a slot that's free by the time it's written
+	if (NextPacket(ch) >= committed_packets + kBufferPackets)
+		return TLM_SYNC_ERROR;
+#endif
+	return TLM_OK;
+}
+
+bool IsStreamHeader(const uint8_t* data) {
+	uint32_t magic;
+
+	memcpy(&magic, data, 4);
+	return magic == STREAM_HEADER_MAGIC;
+}
+
+//Checks the header packet at the start of the stream.
+//Returns TLM_OK to go on receiving, or the reason to stop
+uint16_t ReceiveStreamHeader(const uint8_t* data) {
+	StreamHeader* h = &stream_header;
+
+	memcpy(h, data, sizeof(StreamHeader)); //the header is only in the block buffer until the next packet
+
+	if (h->version != STREAM_HEADER_VERSION || h->size != sizeof(StreamHeader)
+			|| HWCRC_Calc((const uint32_t*)h, STREAM_HEADER_CRC_WORDS) != h->header_crc)
+		return TLM_BAD_HEADER;
+
+	if (h->target_id != STREAM_TARGET_SMR || h->load_address != kStartExecutionAddress)
+		return TLM_WRONG_TARGET;
+
+	if ((h->flags & ~kSupportedStreamFlags) || !h->length || (h->length & 3))
+		return TLM_BAD_HEADER;
+
+	if (h->length > kMaxImageLength)
+		return TLM_IMAGE_TOO_LARGE;
+
+	if (app_valid && ImageInfoIs(h->length, h->image_crc))
+		return TLM_ALREADY_INSTALLED;
+
+	stream_header_received = true;
+	expected_length = h->stream_length;
+	stereo = (h->flags & STREAM_FLAG_STEREO) != 0;
+	handoff.image_version = h->image_version;
+
+	//The header is followed by a page gap, so the first receive sector can be erased now
+	FlashRAM_Unlock();
+	EraseSectorAt(kStartReceiveAddress);
+
+	return TLM_OK;
 }
 
 void init_audio_in(){
 
 	//QPSK or Codec
-	Codec_Init(48000);
-	do {register unsigned int i; for (i = 0; i < 1000000; ++i) __asm__ __volatile__ ("nop\n\t":::"memory");} while (0);
+	//The first discard_samples are thrown away anyways, so the codec only needs a short settling time
+	Codec_Init(SAMPLE_RATE);
+	delay_cycles(CYCLES_PER_MS);
 	I2S_Block_Init();
-	do {register unsigned int i; for (i = 0; i < 1000000; ++i) __asm__ __volatile__ ("nop\n\t":::"memory");} while (0);
+	delay_cycles(CYCLES_PER_MS);
 	I2S_Block_PlayRec();
 
 }
 
+void StartApplication(uint32_t boot_reason) {
+	handoff.boot_reason = boot_reason;
+	Handoff_Write(&handoff);
+
+	//Back to the flash vector table, the SRAM copy will be overwritten by the application's .data/.bss
+	SCB->VTOR = FLASH_BASE;
+	//and to the clock the application's SystemInit() expects (it doesn't turn the over-drive off)
+	ClockProfile_Set(CLOCK_PROFILE_NORMAL);
+	Uninitialize();
+	JumpTo(kStartExecutionAddress);
+}
+
+void UpdateInputGain() {
+	uint32_t now = system_clock.milliseconds();
+	uint32_t level = link_quality.envelope;
+	int16_t gain = input_gain;
+
+	if (ui_state != UI_STATE_WAITING || (now - agc_last_ms) < kAgcIntervalMs)
+		return;
+	agc_last_ms = now;
+
+	if (level < kAgcSilence)
+		return;
+
+	//4 steps of 1.5dB per octave
+	while (level * 2 <= kAgcTarget)	{ level *= 2; gain += 4; }
+	while (level >= kAgcTarget * 2)	{ level /= 2; gain -= 4; }
+
+	if (gain < CODEC_INPUT_GAIN_MIN) gain = CODEC_INPUT_GAIN_MIN;
+	if (gain > CODEC_INPUT_GAIN_MAX) gain = CODEC_INPUT_GAIN_MAX;
+
+	if (gain != input_gain && Codec_SetInputGain(gain) == 0)
+		input_gain = gain;
+}
+
+void UpdateTelemetryLink() {
+	uint16_t jitter = link_quality.jitter;
+
+	Telemetry_Link(link_quality.envelope, link_margin_percent(), jitter > 0xFF ? 0xFF : jitter);
+}
+
+void EndAttempt(uint16_t result, uint32_t symbols) {
+	uint32_t now = system_clock.milliseconds();
+
+	//Errors can happen before the first good packet
+	if (!Telemetry_InProgress())
+		Telemetry_Begin(now);
+
+	Telemetry_Update(now, packet_index, packet_index * kPacketSize, symbols);
+	UpdateTelemetryLink();
+	Telemetry_End(now, result);
+}
+
+void RelocateVectorTable() {
+	for (uint32_t i = 0; i < NUM_VECTORS; i++)
+		ram_vectors[i] = g_pfnVectors[i];
+	__DSB();
+	SCB->VTOR = (uint32_t)ram_vectors;
+	__DSB();
+}
+
 void Init() {
 	sys.Init(false);
+	RelocateVectorTable(); //after SystemInit(), which sets VTOR to the flash table
 	system_clock.Init();
+	init_cycle_counter();
 	init_inouts();
 }
 
-void LED_ring_startup(void){
+void LED_ring_init(void){
 	uint16_t i;
-	uint32_t dly;
-	uint8_t trail=8;
 
 	LED_ON(LED_RING_OE); //actually turns the LED ring off
 	LEDDriver_Init(5);
 	for (i=0;i<26;i++)	LEDDriver_setRGBLED(i,0);
 	LED_OFF(LED_RING_OE); //actually turns the LED ring on
 
-	for (i=0;i<77+trail;i++){
-		if (i<77) LEDDriver_set_one_LED(i, 500);
-		delay(300000);
-		if (i>=trail) LEDDriver_set_one_LED(i-trail, 0);
-	}
+	//From here on the LEDs are only written through the LEDRing framebuffer
+	LEDRing_Init();
+
+	//The sweep itself is stepped by SysTick_Handler() once the timers are started
+	ring_startup_pos=0;
 }
 
 void InitializeReception() {
@@ -388,12 +893,19 @@ void InitializeReception() {
 
 	//FSK
 
-	decoder.Init();
-	decoder.Reset();
+	for (uint8_t ch = 0; ch < kNumChannels; ch++) {
+		decoders[ch].Init(MaxSyncDuration(SAMPLE_RATE, kSymbolRates[0].pause));
+		decoders[ch].Reset();
 
-	demodulator.Init(16, 8, 4);
-	demodulator.Sync();
+		demodulators[ch].Init(kSymbolRates, kNumSymbolRates);
+		demodulators[ch].Sync();
+#if PREFILTER
+		prefilters[ch].Init();
+#endif
 
+		channel_packets[ch] = 0;
+	}
+	stereo = false;
 
 
 	//QPSK
@@ -407,52 +919,184 @@ void InitializeReception() {
 	decoder.Reset();
 */
 
-	current_address = kStartReceiveAddress;
+	StartReceiveArea();
 	packet_index = 0;
-	old_packet_index = 0;
-	slider_i = 0;
+	expected_length = 0;
+	stream_header_received = false;
+	handoff.image_version = 0;
+	audio_cycles_max = 0;
+	audio_cycles_avg = 0;
+	prefilter_cycles_max = 0;
+	prefilter_cycles_avg = 0;
+	audio_overruns = 0;
+	committed_packets = 0;
+	ready_slots = 0;
+	for (uint8_t ch = 0; ch < kNumChannels; ch++)
+		decoders[ch].set_packet_buffer(NextSlot(ch));
+
 	ui_state = UI_STATE_WAITING;
+	set_update_phase(PHASE_NONE);
+}
+
+
+#if CLOCK_BENCHMARK
+//Symbol i of the benchmark transmission: pauses, the preamble, the packet and its CRC, then pauses
+uint8_t BenchSymbol(const uint8_t* packet, uint32_t i) {
+	if (i < kBenchPauses) return 2;
+	i -= kBenchPauses;
+	if (i < kPreambleSize) return i & 1;
+	i -= kPreambleSize;
+	if (i < (kPacketSize + 4) * 8) return (packet[i >> 3] >> (7 - (i & 7))) & 1;
+	return 2;
+}
+
+//Plays one packet at each profile through process_audio_block() (slicer, prefilter and demodulators)
+//and then reads it back through the left packet decoder, timing both with the cycle counter.
+//Switching between NORMAL and FAST relocks the PLL, which can't be done under the audio DMA (see
+//clock_profile.h), so this runs before the codec is started, and calls process_audio_block() itself
+//with one frame at a time, as the DMA interrupt does: the audio cycles don't include the interrupt
+//entry and the DMA handler in i2s.c. The packet is built in the block buffer, and decoded into it.
+void BenchmarkClockProfiles() {
+	const SymbolPeriods& rate = kSymbolRates[0];
+	const uint32_t num_symbols = kBenchPauses + kPreambleSize + (kPacketSize + 4) * 8 + 4;
+	uint8_t* packet = recv_buffer;
+	int16_t frame[4] = {0, 0, 0, 0};
+	int16_t out[4];
+	uint32_t seed = 1;
+
+	//Random data, so the ones and zeros are mixed as in a real image
+	for (uint16_t i = 0; i < kPacketSize; i++) {
+		seed = seed * 1664525 + 1013904223;
+		packet[i] = seed >> 24;
+	}
+
+	discard_samples = 0;
+	for (uint8_t p = 0; p < NUM_CLOCK_PROFILES; p++) {
+		HandoffClockBench& bench = handoff.clock_bench[p];
+		HandoffDecodeBench& decode = handoff.decode_bench[p];
+		Demodulator& demodulator = demodulators[kLeftChannel];
+		PacketDecoder& decoder = decoders[kLeftChannel];
+		PacketDecoderState state = PACKET_DECODER_STATE_SYNCING;
+		uint32_t crc, start, cycles, symbols = 0;
+
+		ClockProfile_Set(ClockProfile(p));
+		InitializeReception();
+		decoder.set_packet_buffer(packet + kPacketSize * 2);
+
+		start = CYCLES;
+		crc = PacketDecoder::Crc32(0, packet, kPacketSize);
+		decode.crc_cycles = CYCLES - start;
+		packet[kPacketSize] = crc >> 24;
+		packet[kPacketSize + 1] = crc >> 16;
+		packet[kPacketSize + 2] = crc >> 8;
+		packet[kPacketSize + 3] = crc;
+
+		for (uint32_t i = 0; i < num_symbols; i++) {
+			uint8_t symbol = BenchSymbol(packet, i);
+			uint8_t period = symbol == 2 ? rate.pause : symbol ? rate.one : rate.zero;
+
+			frame[0] = frame[2] = (i & 1) ? kBenchLevel : -kBenchLevel;
+			while (period--)
+				process_audio_block(frame, out, 0, 4);
+		}
+
+		bench.core_clock_hz = SystemCoreClock;
+		bench.audio_cycles_budget = SystemCoreClock / SAMPLE_RATE;
+		bench.audio_cycles_avg = audio_cycles_avg >> 8;
+		bench.audio_cycles_max = audio_cycles_max;
+		bench.audio_overruns = 0;
+		handoff.prefilter_bench_cycles[p] = prefilter_cycles_avg >> 8;
+
+		decode.cycles = 0;
+		decode.cycles_max = 0;
+		while (demodulator.available()
+				&& (state == PACKET_DECODER_STATE_SYNCING || state == PACKET_DECODER_STATE_DECODING_PACKET)) {
+			start = CYCLES;
+			state = decoder.ProcessSymbol(demodulator.NextSymbol());
+			cycles = CYCLES - start;
+			decode.cycles += cycles;
+			if (cycles > decode.cycles_max) decode.cycles_max = cycles;
+			symbols++;
+		}
+		decode.symbols = state == PACKET_DECODER_STATE_OK ? symbols : 0;
+	}
+
+	//Back to how the capture expects the receivers
+	InitializeReception();
+	discard_samples = SAMPLE_RATE / 6;
+	link_quality.envelope = 0;
+	link_quality.runs = 0;
 }
+#endif
 
 
 int main(void) {
 	uint32_t symbols_processed=0;
-	uint32_t dly=0, button_debounce=0;
-	uint8_t i;
+	uint32_t decode_cycles=0, decode_cycles_max=0, decode_start;	//See handoff.decode_cycles
+	uint32_t startup_start, phase_start=0;
+	uint32_t attempt_start;		//Capture running for the current attempt
+	uint32_t image_length, image_crc;
+	bool force_update;
+	bool installed=false;
+	bool up_to_date=false;
+	uint16_t result;
+
+	//Fast path: nothing but the button and the CRC unit are set up before deciding to jump to the application.
+	//The clocks are already running from SystemInit() in Reset_Handler
+	init_rotary_sw();
+	force_update = debounce_button(BUTTON_DEBOUNCE_CYCLES);
+
+	HWCRC_Init();
+	app_valid = ApplicationIsValid();
+
+	if (!force_update && app_valid){
+		handoff.reset_to_jump_cycles = CYCLES;
+		StartApplication(BOOT_REASON_NORMAL);
+	}
+
+	handoff.flags = force_update ? HANDOFF_FLAG_BUTTON_HELD : HANDOFF_FLAG_IMAGE_INVALID;
+	handoff.attempts = 1;
 
 //	InitializeReception(); //QPSK
 	Init();
 	InitializeReception(); //FSK
+	Telemetry_Init();
 
-	dly=4000;
-	while(dly--){
-		if (ROTARY_SW) button_debounce++;
-		else button_debounce=0;
-	}
-	exit_updater = (button_debounce>2000) ? 0 : 1;
+#if CLOCK_BENCHMARK
+	BenchmarkClockProfiles();
+#endif
 
-	if (!exit_updater){
-		LED_OFF(ALL_LOCK_LEDS);
-		LED_SLIDER_OFF(ALL_SLIDERS);
+	startup_start = CYCLES;
 
-		LED_ring_startup();
+	LED_OFF(ALL_LOCK_LEDS);
+	LED_SLIDER_OFF(ALL_SLIDERS);
 
-		init_audio_in(); //QPSK or Codec
-		sys.StartTimers();
-	}
+	//The PLL can only be relocked before the codec is running (see clock_profile.h)
+	ClockProfile_Set(kReceiveProfile);
 
-	dly=4000;
-	while(dly--){
-		if (ROTARY_SW) button_debounce++;
-		else button_debounce=0;
-	}
-	exit_updater = (button_debounce>2000) ? 0 : 1;
+	//Start listening first, the LED ring animation runs in the background
+	init_audio_in(); //QPSK or Codec
+	LED_ring_init();
+	sys.StartTimers();
+
+	handoff.startup_cycles = CYCLES - startup_start;
+	attempt_start = system_clock.milliseconds();
+
+	//Button must still be held after startup, unless there's no valid application to go back to
+	exit_updater = app_valid && !debounce_button(BUTTON_HOLD_CYCLES);
+
+#if STREAM_COMMIT
+	if (!exit_updater)
+		EraseAhead();
+#endif
 
 	manual_exit_primed=0;
 
 	while (!exit_updater) {
 		g_error = false;
 
+		UpdateInputGain();
+
 
 		//QPSK
 		/*
@@ -466,81 +1110,231 @@ int main(void) {
 		 */
 
 
-		while (demodulator.available() && !g_error && !exit_updater) {
-			uint8_t symbol = demodulator.NextSymbol();
-			PacketDecoderState state = decoder.ProcessSymbol(symbol);
-			symbols_processed++;
-
-			switch (state) {
-				case PACKET_DECODER_STATE_OK:
-				{
-					ui_state = UI_STATE_RECEIVING;
-					memcpy(recv_buffer + (packet_index % kPacketsPerBlock) * kPacketSize, decoder.packet_data(), kPacketSize);
-					++packet_index;
-					if ((packet_index % kPacketsPerBlock) == 0) {
-						ui_state = UI_STATE_WRITING;
-						ProgramPage(recv_buffer, kBlockSize);
-						decoder.Reset();
-						demodulator.Sync(); //FSK
-						//demodulator.SyncCarrier(false);//QPSK
-					} else {
-						decoder.Reset(); //FSK
-						//demodulator.SyncDecision();//QPSK
+		//Stereo: the right channel is only read once the stream header says it's in use
+		for (uint8_t ch = 0; ch < (stereo ? kNumChannels : 1) && !g_error && !exit_updater; ch++) {
+			Demodulator& demodulator = demodulators[ch];
+			PacketDecoder& decoder = decoders[ch];
+
+			while (demodulator.available() && !g_error && !exit_updater) {
+				decode_start = CYCLES;
+				uint8_t symbol = demodulator.NextSymbol();
+				PacketDecoderState state = decoder.ProcessSymbol(symbol);
+				symbols_processed++;
+				decode_start = CYCLES - decode_start;
+				decode_cycles += decode_start;
+				if (decode_start > decode_cycles_max) decode_cycles_max = decode_start;
+
+				switch (state) {
+					case PACKET_DECODER_STATE_OK:
+					{
+						//The end of transmission is a time, count it in pauses at the rate that was found
+						decoder.set_max_sync_duration(MaxSyncDuration(SAMPLE_RATE, demodulator.pause_period()));
+
+						if (packet_index == 0 && !stream_header_received && ch == kLeftChannel) {
+							phase_start = system_clock.milliseconds();
+							handoff.wait_ms = phase_start - attempt_start;
+							Telemetry_Begin(phase_start);
+							set_update_phase(PHASE_RECEIVE);
+
+							if (IsStreamHeader(decoder.packet_data())) {
+								result = ReceiveStreamHeader(decoder.packet_data());
+								if (result == TLM_ALREADY_INSTALLED) {
+									EndAttempt(result, symbols_processed);
+									up_to_date = true;
+									exit_updater = true;
+								} else if (result != TLM_OK) {
+									EndAttempt(result, symbols_processed);
+									g_error = true;
+								} else {
+									SyncReceivers();
+								}
+								break;
+							}
+						}
+						ui_state = UI_STATE_RECEIVING;
+						decode_start = CYCLES;
+						result = StorePacket(ch);
+						decode_cycles += CYCLES - decode_start;
+						if (result != TLM_OK) {
+							handoff.sync_errors++;
+							EndAttempt(result, symbols_processed);
+							g_error = true;
+							break;
+						}
+#if STREAM_COMMIT
+						result = CommitPackets();
+						if (result != TLM_OK) {
+							EndAttempt(result, symbols_processed);
+							break;
+						}
+#endif
+						if ((packet_index % kPacketsPerBlock) == 0) {
+#if STREAM_COMMIT
+							EraseAhead();
+#else
+							ui_state = UI_STATE_WRITING;
+							uint32_t program_start = system_clock.milliseconds();
+							result = ProgramData(recv_buffer, kBlockSize);
+							handoff.program_ms += system_clock.milliseconds() - program_start;
+							if (result != TLM_OK) {
+								EndAttempt(result, symbols_processed);
+								break;
+							}
+#endif
+							Telemetry_Update(system_clock.milliseconds(), packet_index, packet_index * kPacketSize, symbols_processed);
+							UpdateTelemetryLink();
+							SyncReceivers(); //FSK
+							//demodulator.SyncCarrier(false);//QPSK
+						} else {
+							decoder.Reset(); //FSK
+							decoder.set_packet_buffer(NextSlot(ch));
+							//demodulator.SyncDecision();//QPSK
+						}
 					}
-				}
-				break;
-
-				case PACKET_DECODER_STATE_ERROR_SYNC:
-					LED_ON(LED_LOCK[2]);
-					g_error = true;
-					break;
-
-				case PACKET_DECODER_STATE_ERROR_CRC:
-					LED_ON(LED_LOCK[3]);
-					g_error = true;
-					break;
-
-				case PACKET_DECODER_STATE_END_OF_TRANSMISSION:
-					exit_updater = true;
-					LED_OFF(ALL_LOCK_LEDS);
-					LED_ON(LED_LOCK[0]);
-					LED_ON(LED_LOCK[5]);
-
-					//Copy from Receive buffer to Execution memory
-
-					CopyMemory(kStartReceiveAddress, kStartExecutionAddress, (current_address-kStartReceiveAddress));
-
-					LED_ON(ALL_LOCK_LEDS);
-
 					break;
 
-				default:
-					break;
+					case PACKET_DECODER_STATE_ERROR_SYNC:
+						LED_ON(LED_LOCK[2]);
+						handoff.sync_errors++;
+						EndAttempt(TLM_SYNC_ERROR, symbols_processed);
+						g_error = true;
+						break;
+
+					case PACKET_DECODER_STATE_ERROR_CRC:
+						LED_ON(LED_LOCK[3]);
+						handoff.crc_errors++;
+						EndAttempt(TLM_CRC_ERROR, symbols_processed);
+						g_error = true;
+						break;
+
+					case PACKET_DECODER_STATE_END_OF_TRANSMISSION:
+						if (ch != kLeftChannel) //the right channel ends at the same time
+							break;
+						exit_updater = true;
+						LED_OFF(ALL_LOCK_LEDS);
+						LED_ON(LED_LOCK[0]);
+						LED_ON(LED_LOCK[5]);
+
+						handoff.receive_ms = system_clock.milliseconds() - phase_start;
+						handoff.bytes_received = packet_index * kPacketSize;
+						handoff.sample_rate = SAMPLE_RATE;
+						handoff.audio_cycles_budget = SystemCoreClock / SAMPLE_RATE;
+						handoff.core_clock_hz = SystemCoreClock;
+						handoff.input_gain = input_gain;
+						handoff.audio_cycles_avg = audio_cycles_avg >> 8;
+						handoff.audio_cycles_max = audio_cycles_max;
+						handoff.audio_overruns = audio_overruns;
+						handoff.symbols_lost = demodulators[kLeftChannel].symbols_lost() + demodulators[kRightChannel].symbols_lost();
+						handoff.decode_symbols = symbols_processed;
+						handoff.decode_cycles = decode_cycles;
+						handoff.decode_cycles_max = decode_cycles_max;
+						handoff.prefilter_cycles_avg = prefilter_cycles_avg >> 8;
+						handoff.prefilter_cycles_max = prefilter_cycles_max;
+						phase_start = system_clock.milliseconds();
+
+						//Copy from Receive buffer to Execution memory
+						set_update_phase(PHASE_VERIFY);
+						if (stream_header_received)
+							image_length = stream_header.length;
+						else
+							image_length = ImageLength(kStartReceiveAddress, current_address - kStartReceiveAddress);
+
+						if (image_length > kMaxImageLength) {
+							EndAttempt(TLM_IMAGE_TOO_LARGE, symbols_processed);
+							exit_updater = false;
+							g_error = true;
+							break;
+						}
+						if (stream_header_received && (stream_header.flags & STREAM_FLAG_SPARSE)) {
+							if (sparse_state != SPARSE_DONE) {
+								EndAttempt(TLM_TRUNCATED, symbols_processed);
+								exit_updater = false;
+								g_error = true;
+								break;
+							}
+							//The rest of the image was not sent, make sure it reads as 0xFF
+							FlashRAM_Unlock();
+							SkipErasedTo(kStartReceiveAddress + image_length);
+						}
+						if (image_length > (current_address - kStartReceiveAddress)) {
+							EndAttempt(TLM_TRUNCATED, symbols_processed);
+							exit_updater = false;
+							g_error = true;
+							break;
+						}
+						image_crc = HWCRC_Calc((const uint32_t*)kStartReceiveAddress, image_length / 4);
+						if (stream_header_received && image_crc != stream_header.image_crc) {
+							EndAttempt(TLM_VERIFY_FAILED, symbols_processed);
+							exit_updater = false;
+							g_error = true;
+							break;
+						}
+
+						set_update_phase(PHASE_COPY);
+						InvalidateImageInfo();
+						CopyMemory(kStartReceiveAddress, kStartExecutionAddress, image_length);
+						WriteImageInfo(image_length, image_crc);
+						WriteHeldVectors(kStartReceiveAddress, kStartExecutionAddress);
+
+						//Verifies the copy against the CRC of what was received
+						set_update_phase(PHASE_VERIFY);
+						app_valid = ApplicationIsValid() && ImageInfoIs(image_length, image_crc);
+						if (!app_valid) {
+							EndAttempt(TLM_VERIFY_FAILED, symbols_processed);
+							exit_updater = false;
+							g_error = true;
+							break;
+						}
+
+						handoff.copy_ms = system_clock.milliseconds() - phase_start;
+						handoff.image_length = image_length;
+						handoff.image_crc = image_crc;
+						installed = true;
+						EndAttempt(TLM_OK, symbols_processed);
+
+						LED_ON(ALL_LOCK_LEDS);
+
+						break;
+
+					default:
+						break;
+				}
 			}
 		}
 		if (g_error) {
 			ui_state = UI_STATE_ERROR;
 
 			LED_ON(LED_LOCK[1]);
+			ClockProfile_Set(CLOCK_PROFILE_IDLE);
 			while (!ROTARY_SW){;}
 
 			LED_OFF(LED_LOCK[1]);
 			while (ROTARY_SW){;}
+			ClockProfile_Set(kReceiveProfile);
 
 			LED_OFF(ALL_LOCK_LEDS);
 			LED_SLIDER_OFF(ALL_SLIDERS);
 
-			for (i=0;i<26;i++){
-				LEDDriver_setRGBLED(i,0);
-			}
+			LEDRing_Clear();
 
 			InitializeReception();
+			attempt_start = system_clock.milliseconds();
+#if STREAM_COMMIT
+			EraseAhead();
+#endif
 			manual_exit_primed=0;
 			exit_updater=false;
+
+			handoff.attempts++;
+			handoff.program_ms = 0;
+			symbols_processed = 0;
+			decode_cycles = 0;
+			decode_cycles_max = 0;
 		}
 	}
 
-	Uninitialize();
-	JumpTo(kStartExecutionAddress);
+	if (installed)			StartApplication(BOOT_REASON_UPDATED);
+	else if (up_to_date)	StartApplication(BOOT_REASON_UP_TO_DATE);
+	else					StartApplication(BOOT_REASON_USER_EXIT);
 
 }
@@ -0,0 +1,116 @@
+/*
+ * clock_profile.c - core clock profiles, switched at runtime
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include "clock_profile.h"
+
+#define PLL_N_NORMAL	336		/* VCO 336MHz / PLL_P 2 */
+#define PLL_N_FAST		360
+#define PLL_P			2
+
+//Flash wait states needed per 30MHz of HCLK, at 2.7-3.6V
+#define HCLK_PER_WAIT_STATE 30000000
+
+static enum ClockProfile current_profile = CLOCK_PROFILE_NORMAL;
+
+static uint32_t flash_latency(uint32_t hclk)
+{
+	return (hclk - 1) / HCLK_PER_WAIT_STATE;
+}
+
+static void set_flash_latency(uint32_t latency)
+{
+	FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | latency;
+	while ((FLASH->ACR & FLASH_ACR_LATENCY) != latency) {;}
+}
+
+static void set_sysclk_source(uint32_t sw, uint32_t sws)
+{
+	RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | sw;
+	while ((RCC->CFGR & RCC_CFGR_SWS) != sws) {;}
+}
+
+//Runs from the HSE while the main PLL relocks. The PLL input divider (PLL_M), which
+//PLLI2S shares, stays the same.
+static void relock_pll(uint32_t plln, uint8_t overdrive)
+{
+	set_sysclk_source(RCC_CFGR_SW_HSE, RCC_CFGR_SWS_HSE);
+
+	RCC->CR &= ~RCC_CR_PLLON;
+	while (RCC->CR & RCC_CR_PLLRDY) {;}
+	RCC->PLLCFGR = (RCC->PLLCFGR & ~RCC_PLLCFGR_PLLN) | (plln << 6);
+	RCC->CR |= RCC_CR_PLLON;
+
+	//The over-drive is switched while the system clock is the HSE (RM0090, 5.1.4)
+	if (overdrive) {
+		PWR->CR |= PWR_CR_ODEN;
+		while (!(PWR->CSR & PWR_CSR_ODRDY)) {;}
+		PWR->CR |= PWR_CR_ODSWEN;
+		while (!(PWR->CSR & PWR_CSR_ODSWRDY)) {;}
+	} else {
+		PWR->CR &= ~(PWR_CR_ODEN | PWR_CR_ODSWEN);
+		while (PWR->CSR & PWR_CSR_ODSWRDY) {;}
+	}
+
+	while (!(RCC->CR & RCC_CR_PLLRDY)) {;}
+	set_sysclk_source(RCC_CFGR_SW_PLL, RCC_CFGR_SWS_PLL);
+}
+
+void ClockProfile_Set(enum ClockProfile profile)
+{
+	uint32_t plln = (RCC->PLLCFGR & RCC_PLLCFGR_PLLN) >> 6;
+	uint32_t pllm = RCC->PLLCFGR & RCC_PLLCFGR_PLLM;
+	uint32_t hclk, latency;
+
+	if (profile == CLOCK_PROFILE_NORMAL)	plln = PLL_N_NORMAL;
+	else if (profile == CLOCK_PROFILE_FAST)	plln = PLL_N_FAST;
+
+	hclk = (HSE_VALUE / pllm) * plln / PLL_P;
+	if (profile == CLOCK_PROFILE_IDLE) hclk /= 4;
+	latency = flash_latency(hclk);
+
+	//More wait states before speeding up, fewer only once slowed down
+	if (latency > (FLASH->ACR & FLASH_ACR_LATENCY))
+		set_flash_latency(latency);
+
+	if (plln != ((RCC->PLLCFGR & RCC_PLLCFGR_PLLN) >> 6))
+		relock_pll(plln, profile == CLOCK_PROFILE_FAST);
+
+	RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_HPRE) | (profile == CLOCK_PROFILE_IDLE ? RCC_CFGR_HPRE_DIV4 : RCC_CFGR_HPRE_DIV1);
+
+	set_flash_latency(latency);
+
+	SystemCoreClock = hclk;
+	SysTick->LOAD = hclk / 1000 - 1;
+
+	current_profile = profile;
+}
+
+enum ClockProfile ClockProfile_Get(void)
+{
+	return current_profile;
+}
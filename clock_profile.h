@@ -0,0 +1,62 @@
+/*
+ * clock_profile.h - core clock profiles, switched at runtime
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef CLOCK_PROFILE_H_
+#define CLOCK_PROFILE_H_
+
+#include "stm32f4xx.h"
+
+// SystemInit() starts the core at 168MHz. The profiles change the main PLL and the AHB
+// prescaler only: the I2S clock comes from PLLI2S, which is never touched, so the codec
+// keeps running at the same rate through a switch.
+//
+// CLOCK_PROFILE_IDLE divides the current PLL output by 4 (42MHz, or 45MHz from FAST).
+// That's just a prescaler change, it can be done any time.
+//
+// Switching between NORMAL and FAST relocks the main PLL (and turns the over-drive on or off),
+// which runs the core from the 8MHz HSE for a few hundred us. The audio DMA keeps going,
+// but the audio interrupts that come in meanwhile can run late enough to lose a block,
+// so the bootloader only does it while it isn't receiving.
+//
+// APB1/APB2 stay at HCLK/4 and HCLK/2: 45MHz and 90MHz in FAST, the most they're rated for.
+// The I2C peripherals aren't re-initialized, so their bus clock scales with HCLK.
+//
+// SystemCoreClock and the SysTick reload are updated, so the ms count keeps its rate.
+
+enum ClockProfile {
+	CLOCK_PROFILE_IDLE		= 0,	/* HCLK/4 */
+	CLOCK_PROFILE_NORMAL	= 1,	/* 168MHz, as set by SystemInit() */
+	CLOCK_PROFILE_FAST		= 2,	/* 180MHz with over-drive */
+
+	NUM_CLOCK_PROFILES
+};
+
+void ClockProfile_Set(enum ClockProfile profile);
+enum ClockProfile ClockProfile_Get(void);
+
+#endif /* CLOCK_PROFILE_H_ */
@@ -37,20 +37,19 @@
   */
   
 #include "codec.h"
+#include "pins.h"
+#include "i2c_master.h"
 
-/* Mask for the bit EN of the I2S CFGR register */
-#define I2S_ENABLE_MASK                 0x0400
-
-/* Codec audio Standards */
+/* Codec audio Standards (I2SSTD in SPI_I2SCFGR) */
 #ifdef I2S_STANDARD_PHILLIPS
  #define  CODEC_STANDARD                0x04
- #define I2S_STANDARD                   I2S_Standard_Phillips         
+ #define I2S_STANDARD                   0
 #elif defined(I2S_STANDARD_MSB)
  #define  CODEC_STANDARD                0x00
- #define I2S_STANDARD                   I2S_Standard_MSB    
+ #define I2S_STANDARD                   SPI_I2SCFGR_I2SSTD_0
 #elif defined(I2S_STANDARD_LSB)
  #define  CODEC_STANDARD                0x08
- #define I2S_STANDARD                   I2S_Standard_LSB    
+ #define I2S_STANDARD                   SPI_I2SCFGR_I2SSTD_1
 #else 
  #error "Error: No audio communication standard selected !"
 #endif /* I2S_STANDARD */
@@ -109,6 +108,24 @@
 #define format_24b (2<<2)
 #define format_32b (3<<2)
 
+//Register 8: Sampling Control
+#define USB_normal		(0 << 0)		/* Normal mode, MCLK is a multiple of the sample rate */
+#define BOSR_256fs		(0 << 1)		/* Base oversampling rate */
+#define SR_48k			(0b0000 << 2)	/* ADC/DAC 48k with a 12.288MHz core clock */
+#define SR_96k			(0b0111 << 2)	/* ADC/DAC 96k with a 12.288MHz core clock */
+#define CLKIDIV2		(1 << 6)		/* Core clock is MCLK/2 */
+
+// The I2S peripheral outputs MCLK at 256fs. At 96k that's 24.576MHz, above what the
+// WM8731 core takes, so it's divided by 2 and the codec runs from 12.288MHz in both modes.
+//
+// I2SCLK = PLLI2S_VCO / PLLI2S_R, with PLLI2S_VCO = 1MHz * PLLI2S_N (see system_stm32f4xx.c).
+// The 86MHz set up by SystemInit() can't be divided down to 96k*256, so 96k uses 172MHz
+// (the values from the I2S table in the reference manual, 0.02% error at both rates).
+#define PLLI2S_N_48k	258
+#define PLLI2S_R_48k	3
+#define PLLI2S_N_96k	344
+#define PLLI2S_R_96k	2
+
 // Oddness:
 // format_I2S does not work with I2S2 on the STM32F427Z (works on the 427V) in Master TX mode (I2S2ext is RX)
 // The RX data is shifted left 2 bits (x4) as it comes in, causing digital wrap-around clipping.
@@ -138,11 +155,18 @@ const uint16_t w8731_init_data[] =
 	(format_24b			// Reg 07: Digital Audio Interface Format (24-bit, slave)
 	| format_I2S),
 
-	0x000,				// Reg 08: Sampling Control (Normal, 256x, 48k ADC/DAC)
+	(USB_normal			// Reg 08: Sampling Control (Normal, 256x, 48k ADC/DAC), see Codec_Init()
+	| BOSR_256fs
+	| SR_48k),
 
 	0x001				// Reg 09: Active Control
 };
 
+#define W8731_SAMPLING_CONTROL_REG 8
+
+//Reg 08 value for the rate given to Codec_Init()
+static uint16_t sampling_control = (USB_normal | BOSR_256fs | SR_48k);
+
 
 
 /*
@@ -163,10 +187,6 @@ const uint16_t w8731_init_data[] =
 /* The 7 bits Codec address (sent through I2C interface) */
 #define CODEC_ADDRESS           (W8731_ADDR_0<<1)
 
-/* local vars */
-__IO uint32_t  CODECTimeout = CODEC_LONG_TIMEOUT;   
-__IO uint8_t OutputDev = 0;
-
 
 /**
   * @brief  Inserts a delay time (not accurate timing).
@@ -198,10 +218,46 @@ uint32_t Codec_TIMEOUT_UserCallback(void)
 }
 #endif /* USE_DEFAULT_TIMEOUT_CALLBACK */
 
+//The I2S clock has to be stopped to change it, so this must run before the I2S is enabled
+static void Codec_I2SClock_Init(uint32_t AudioFreq)
+{
+	uint32_t plli2s_n = (AudioFreq > 48000) ? PLLI2S_N_96k : PLLI2S_N_48k;
+	uint32_t plli2s_r = (AudioFreq > 48000) ? PLLI2S_R_96k : PLLI2S_R_48k;
+
+	if (RCC->PLLI2SCFGR == ((plli2s_n << 6) | (plli2s_r << 28)))
+		return;
+
+	RCC->CR &= ~RCC_CR_PLLI2SON;
+	RCC->PLLI2SCFGR = (plli2s_n << 6) | (plli2s_r << 28);
+	RCC->CR |= RCC_CR_PLLI2SON;
+	while ((RCC->CR & RCC_CR_PLLI2SRDY) == 0) {;}
+}
+
+//I2SDIV and ODD for MCLK at 256fs from the PLLI2S output, rounded as I2S_Init() does
+static uint16_t Codec_I2SPrescaler(uint32_t AudioFreq)
+{
+	uint32_t plln = (RCC->PLLI2SCFGR & RCC_PLLI2SCFGR_PLLI2SN) >> 6;
+	uint32_t pllr = (RCC->PLLI2SCFGR & RCC_PLLI2SCFGR_PLLI2SR) >> 28;
+	uint32_t i2sclk = ((HSE_VALUE / (RCC->PLLCFGR & RCC_PLLCFGR_PLLM)) * plln) / pllr;
+	uint32_t div = ((((i2sclk / 256) * 10) / AudioFreq) + 5) / 10;
+
+	if (div < 4 || div > 0x1FF)
+		return 2;
+	return (div >> 1) | ((div & 1) ? SPI_I2SPR_ODD : 0);
+}
+
+/* AudioFreq: 48000 or 96000 */
 uint32_t Codec_Init(uint32_t AudioFreq)
 {
 	uint32_t err = 0;
 
+	if (AudioFreq > 48000)
+		sampling_control = USB_normal | BOSR_256fs | SR_96k | CLKIDIV2;
+	else
+		sampling_control = USB_normal | BOSR_256fs | SR_48k;
+
+	Codec_I2SClock_Init(AudioFreq);
+
 	/* Configure the Codec related IOs */
 	Codec_GPIO_Init();   
 
@@ -235,11 +291,24 @@ uint32_t Codec_Reset(void)
 	/* Load default values */
 	for(i=0;i<W8731_NUM_REGS;i++)
 	{
-		err=Codec_WriteRegister(i, w8731_init_data[i]);
+		if (i == W8731_SAMPLING_CONTROL_REG)
+			err=Codec_WriteRegister(i, sampling_control);
+		else
+			err=Codec_WriteRegister(i, w8731_init_data[i]);
 	}
 	return err;
 }
 
+//Line input volume of both channels: Reg 00 with INBOTH also loads Reg 01.
+//Returns 0 if the codec took it.
+uint32_t Codec_SetInputGain(uint8_t gain)
+{
+	if (gain > CODEC_INPUT_GAIN_MAX)
+		gain = CODEC_INPUT_GAIN_MAX;
+
+	return Codec_WriteRegister(0, (1 << INBOTH) | (0 << INMUTE) | (gain << INVOL));
+}
+
 /**
   * @brief  Writes a Byte to a given register into the audio codec through the
             control interface (I2C)
@@ -250,65 +319,21 @@ uint32_t Codec_Reset(void)
 uint32_t Codec_WriteRegister(uint8_t RegisterAddr, uint16_t RegisterValue)
 {
 	uint32_t result = 0;
-	
+
 	/* Assemble 2-byte data in WM8731 format */
 	uint8_t Byte1 = ((RegisterAddr<<1)&0xFE) | ((RegisterValue>>8)&0x01);
 	uint8_t Byte2 = RegisterValue&0xFF;
 	
-	/*!< While the bus is busy */
-	CODECTimeout = CODEC_LONG_TIMEOUT;
-	while(I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_BUSY))
-	{
-		if((CODECTimeout--) == 0)
-			return Codec_TIMEOUT_UserCallback();
-	}
-
-	/* Start the config sequence */
-	I2C_GenerateSTART(CODEC_I2C, ENABLE);
+	if (I2CMaster_Start(CODEC_I2C, CODEC_ADDRESS, CODEC_FLAG_TIMEOUT, CODEC_LONG_TIMEOUT)
+			|| I2CMaster_Send(CODEC_I2C, Byte1, CODEC_FLAG_TIMEOUT))
+		return Codec_TIMEOUT_UserCallback();
 
-	/* Test on EV5 and clear it */
-	CODECTimeout = CODEC_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_MODE_SELECT))
-	{
-		if((CODECTimeout--) == 0)
-			return Codec_TIMEOUT_UserCallback();
-	}
+	/* Send the register value, and wait till it has been physically transferred on the bus */
+	CODEC_I2C->DR = Byte2;
+	if (I2CMaster_WaitSR1(CODEC_I2C, I2C_SR1_BTF, CODEC_LONG_TIMEOUT))
+		return Codec_TIMEOUT_UserCallback();
 
-	/* Transmit the slave address and enable writing operation */
-	I2C_Send7bitAddress(CODEC_I2C, CODEC_ADDRESS, I2C_Direction_Transmitter);
-
-	/* Test on EV6 and clear it */
-	CODECTimeout = CODEC_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
-	{
-		if((CODECTimeout--) == 0)
-			return Codec_TIMEOUT_UserCallback();
-	}
-
-	/* Transmit the first address for write operation */
-	I2C_SendData(CODEC_I2C, Byte1);
-
-	/* Test on EV8 and clear it */
-	CODECTimeout = CODEC_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(CODEC_I2C, I2C_EVENT_MASTER_BYTE_TRANSMITTING))
-	{
-		if((CODECTimeout--) == 0)
-			return Codec_TIMEOUT_UserCallback();
-	}
-
-	/* Prepare the register value to be sent */
-	I2C_SendData(CODEC_I2C, Byte2);
-
-	/*!< Wait till all data have been physically transferred on the bus */
-	CODECTimeout = CODEC_LONG_TIMEOUT;
-	while(!I2C_GetFlagStatus(CODEC_I2C, I2C_FLAG_BTF))
-	{
-		if((CODECTimeout--) == 0)
-			return Codec_TIMEOUT_UserCallback();
-	}
-
-	/* End the configuration sequence */
-	I2C_GenerateSTOP(CODEC_I2C, ENABLE);
+	I2CMaster_Stop(CODEC_I2C);
 
 	/* Return the verifying value: 0 (Passed) or 1 (Failed) */
 	return result;  
@@ -321,23 +346,11 @@ uint32_t Codec_WriteRegister(uint8_t RegisterAddr, uint16_t RegisterValue)
   */
 void Codec_CtrlInterface_Init(void)
 {
-	I2C_InitTypeDef I2C_InitStructure;
-
 	/* Enable the CODEC_I2C peripheral clock */
 	RCC_APB1PeriphClockCmd(CODEC_I2C_CLK, ENABLE);
 
-	/* CODEC_I2C peripheral configuration */
-	I2C_DeInit(CODEC_I2C);
-	I2C_InitStructure.I2C_Mode = I2C_Mode_I2C;
-	I2C_InitStructure.I2C_DutyCycle = I2C_DutyCycle_2;
-	I2C_InitStructure.I2C_OwnAddress1 = 0x33;
-	I2C_InitStructure.I2C_Ack = I2C_Ack_Enable;
-	I2C_InitStructure.I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
-	I2C_InitStructure.I2C_ClockSpeed = I2C_SPEED;
-	
-	/* Enable the I2C peripheral */
-	I2C_Cmd(CODEC_I2C, ENABLE);
-	I2C_Init(CODEC_I2C, &I2C_InitStructure);
+	/* Reset and configure it, and enable it */
+	I2CMaster_Init(CODEC_I2C, CODEC_I2C_CLK, 0x33, I2C_SPEED);
 }
 
 /**
@@ -350,25 +363,26 @@ void Codec_CtrlInterface_Init(void)
   */
 void Codec_AudioInterface_Init(uint32_t AudioFreq)
 {
-	I2S_InitTypeDef I2S_InitStructure;
+	/* 24-bit data in 32-bit channels, clock low when idle */
+	const uint16_t format = SPI_I2SCFGR_I2SMOD | I2S_STANDARD | SPI_I2SCFGR_DATLEN_0 | SPI_I2SCFGR_CHLEN;
 
 	/* Enable the CODEC_I2S peripheral clock */
 	RCC_APB1PeriphClockCmd(CODEC_I2S_CLK, ENABLE);
 
-	/* CODEC_I2S peripheral configuration for master TX */
-	SPI_I2S_DeInit(CODEC_I2S);
-	I2S_InitStructure.I2S_AudioFreq = AudioFreq;
-	I2S_InitStructure.I2S_Standard = I2S_STANDARD;
-	I2S_InitStructure.I2S_DataFormat = I2S_DataFormat_24b;//extended;
-	I2S_InitStructure.I2S_CPOL = I2S_CPOL_Low;
-	I2S_InitStructure.I2S_Mode = I2S_Mode_MasterTx;
-	I2S_InitStructure.I2S_MCLKOutput = I2S_MCLKOutput_Enable;
+	/* Reset SPI2 and I2S2ext (what SPI_I2S_DeInit() did) */
+	RCC->APB1RSTR |= RCC_APB1RSTR_SPI2RST;
+	RCC->APB1RSTR &= ~RCC_APB1RSTR_SPI2RST;
 
-	/* Initialize the I2S main channel for TX */
-	I2S_Init(CODEC_I2S, &I2S_InitStructure);
+	/* I2S clock from PLLI2S, set up by Codec_I2SClock_Init() */
+	RCC->CFGR &= ~RCC_CFGR_I2SSRC;
 
-	/* Initialize the I2S extended channel for RX */
-	I2S_FullDuplexConfig(CODEC_I2S_EXT, &I2S_InitStructure);
+	/* Main channel: master TX, with MCLK output */
+	CODEC_I2S->I2SPR = Codec_I2SPrescaler(AudioFreq) | SPI_I2SPR_MCKOE;
+	CODEC_I2S->I2SCFGR = format | SPI_I2SCFGR_I2SCFG_1;
+
+	/* Extended channel: slave RX, clocked by the main one (what I2S_FullDuplexConfig() did) */
+	CODEC_I2S_EXT->I2SPR = 0x0002;
+	CODEC_I2S_EXT->I2SCFGR = format | SPI_I2SCFGR_I2SCFG_0;
 
 	/* The I2S peripheral will be enabled only in the EVAL_AUDIO_Play() function
 	or by user functions if DMA mode not enabled */
@@ -382,39 +396,27 @@ void Codec_AudioInterface_Init(uint32_t AudioFreq)
   */
 void Codec_GPIO_Init(void)
 {
-	GPIO_InitTypeDef GPIO_InitStructure;
-
 	/* Enable I2S and I2C GPIO clocks */
 	RCC_AHB1PeriphClockCmd(CODEC_I2C_GPIO_CLOCK | CODEC_I2S_GPIO_CLOCK, ENABLE);
 
 	/* CODEC_I2C SCL and SDA pins configuration -------------------------------------*/
-	GPIO_InitStructure.GPIO_Pin = CODEC_I2C_SCL_PIN | CODEC_I2C_SDA_PIN;
-	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
-	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_2MHz;
-	GPIO_InitStructure.GPIO_OType = GPIO_OType_OD;
-	GPIO_InitStructure.GPIO_PuPd  = GPIO_PuPd_NOPULL;
-	GPIO_Init(CODEC_I2C_GPIO, &GPIO_InitStructure);
+	Pins_Init(CODEC_I2C_GPIO, CODEC_I2C_SCL_PIN | CODEC_I2C_SDA_PIN, GPIO_Mode_AF, GPIO_OType_OD, GPIO_Speed_2MHz, GPIO_PuPd_NOPULL);
 
 	/* Connect pins to I2C peripheral */
-	GPIO_PinAFConfig(CODEC_I2C_GPIO, CODEC_I2S_SCL_PINSRC, CODEC_I2C_GPIO_AF);
-	GPIO_PinAFConfig(CODEC_I2C_GPIO, CODEC_I2S_SDA_PINSRC, CODEC_I2C_GPIO_AF);
+	Pins_SetAF(CODEC_I2C_GPIO, CODEC_I2S_SCL_PINSRC, CODEC_I2C_GPIO_AF);
+	Pins_SetAF(CODEC_I2C_GPIO, CODEC_I2S_SDA_PINSRC, CODEC_I2C_GPIO_AF);
 
 	/* CODEC_I2S output pins configuration: WS, SCK SD0 and SDI pins ------------------*/
-	GPIO_InitStructure.GPIO_Pin = CODEC_I2S_SCK_PIN | CODEC_I2S_SDO_PIN | CODEC_I2S_SDI_PIN | CODEC_I2S_WS_PIN;
-	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
-	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_2MHz;
-	GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
-	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
-	GPIO_Init(CODEC_I2S_GPIO, &GPIO_InitStructure);
+	Pins_Init(CODEC_I2S_GPIO, CODEC_I2S_SCK_PIN | CODEC_I2S_SDO_PIN | CODEC_I2S_SDI_PIN | CODEC_I2S_WS_PIN,
+			GPIO_Mode_AF, GPIO_OType_PP, GPIO_Speed_2MHz, GPIO_PuPd_NOPULL);
 
 	/* CODEC_I2S pins configuration: MCK pin */
-	GPIO_InitStructure.GPIO_Pin = CODEC_I2S_MCK_PIN;
-	GPIO_Init(CODEC_I2S_MCK_GPIO, &GPIO_InitStructure);
+	Pins_Init(CODEC_I2S_MCK_GPIO, CODEC_I2S_MCK_PIN, GPIO_Mode_AF, GPIO_OType_PP, GPIO_Speed_2MHz, GPIO_PuPd_NOPULL);
 
 	/* Connect pins to I2S peripheral  */
-	GPIO_PinAFConfig(CODEC_I2S_GPIO, CODEC_I2S_WS_PINSRC, CODEC_I2S_GPIO_AF);
-	GPIO_PinAFConfig(CODEC_I2S_GPIO, CODEC_I2S_SCK_PINSRC, CODEC_I2S_GPIO_AF);
-	GPIO_PinAFConfig(CODEC_I2S_GPIO, CODEC_I2S_SDO_PINSRC, CODEC_I2S_GPIO_AF);
-	GPIO_PinAFConfig(CODEC_I2S_GPIO, CODEC_I2S_SDI_PINSRC, CODEC_I2S_GPIO_AF);
-	GPIO_PinAFConfig(CODEC_I2S_MCK_GPIO, CODEC_I2S_MCK_PINSRC, CODEC_I2S_GPIO_AF);
+	Pins_SetAF(CODEC_I2S_GPIO, CODEC_I2S_WS_PINSRC, CODEC_I2S_GPIO_AF);
+	Pins_SetAF(CODEC_I2S_GPIO, CODEC_I2S_SCK_PINSRC, CODEC_I2S_GPIO_AF);
+	Pins_SetAF(CODEC_I2S_GPIO, CODEC_I2S_SDO_PINSRC, CODEC_I2S_GPIO_AF);
+	Pins_SetAF(CODEC_I2S_GPIO, CODEC_I2S_SDI_PINSRC, CODEC_I2S_GPIO_AF);
+	Pins_SetAF(CODEC_I2S_MCK_GPIO, CODEC_I2S_MCK_PINSRC, CODEC_I2S_GPIO_AF);
 }
@@ -72,6 +72,15 @@ Hardware Configuration defines parameters
 #define AUDIO_I2S_EXT_DMA_FLAG_FE      DMA_FLAG_FEIF3
 #define AUDIO_I2S_EXT_DMA_FLAG_TE      DMA_FLAG_TEIF3
 #define AUDIO_I2S_EXT_DMA_FLAG_DME     DMA_FLAG_DMEIF3
+//Register level, for the interrupt handler (which runs from SRAM and can't call StdPeriph)
+#define AUDIO_I2S_EXT_DMA_ISR          DMA1->LISR
+#define AUDIO_I2S_EXT_DMA_IFCR         DMA1->LIFCR
+#define AUDIO_I2S_EXT_DMA_ISR_TC       DMA_LISR_TCIF3
+#define AUDIO_I2S_EXT_DMA_ISR_HT       DMA_LISR_HTIF3
+//All flags of each stream, cleared before it's set up (as DMA_DeInit() did)
+#define AUDIO_I2S_DMA_IFCR             DMA1->HIFCR
+#define AUDIO_I2S_DMA_IFCR_ALL         (DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4)
+#define AUDIO_I2S_EXT_DMA_IFCR_ALL     (DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
 
 /* I2C peripheral configuration defines (control interface of the audio codec) */
 #define CODEC_I2C                      I2C2
@@ -103,8 +112,14 @@ Hardware Configuration defines parameters
 
 /*----------------------------------------------------------------------------*/
 
+/* Line input gain for Codec_SetInputGain(), in 1.5dB steps from -34.5dB to +12dB */
+#define CODEC_INPUT_GAIN_MIN           0
+#define CODEC_INPUT_GAIN_0dB           23
+#define CODEC_INPUT_GAIN_MAX           31
+
 /* High Layer codec functions */
 uint32_t Codec_Init(uint32_t AudioFreq);
+uint32_t Codec_SetInputGain(uint8_t gain);
 
 /* Low layer codec functions */
 void     Codec_CtrlInterface_Init(void);
@@ -0,0 +1,56 @@
+/*
+ * cycle_counter.h - DWT cycle counter, used for timing measurements
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef CYCLE_COUNTER_H_
+#define CYCLE_COUNTER_H_
+
+#include "stm32f4xx.h"
+
+//The CMSIS core header shipped here predates the DWT struct, so address the registers directly
+#define DWT_CTRL			(*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT			(*(volatile uint32_t *)0xE0001004)
+#define DWT_CTRL_CYCCNTENA	(1 << 0)
+
+#define CYCLES DWT_CYCCNT
+
+//Follows the clock profile, see clock_profile.h
+#define CYCLES_PER_MS (SystemCoreClock/1000)
+
+static inline void init_cycle_counter(void){
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+//Busy-waits for a number of core cycles. Wrap-around safe up to 2^32 cycles (~25s at 168MHz)
+static inline void delay_cycles(uint32_t cycles){
+	uint32_t start = CYCLES;
+	while ((CYCLES - start) < cycles) {;}
+}
+
+#endif /* CYCLE_COUNTER_H_ */
@@ -0,0 +1,272 @@
+/*
+ * flash_image.cc - Writes the received image to the receive area, and installs it
+ *
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include "flash_image.h"
+
+extern "C" {
+#include "flash_ram.h"
+#include "hw_crc.h"
+#include "stream_header.h"
+#include "telemetry.h"
+}
+
+//Valid initial stack pointers for the application: main SRAM or CCM RAM
+const uint32_t kRamStart = 				0x20000000;
+const uint32_t kRamEnd = 				0x20030000;
+const uint32_t kCCMRamStart = 			0x10000000;
+const uint32_t kCCMRamEnd = 			0x10010000;
+
+uint32_t current_address;
+uint32_t erased_sectors;
+SparseState sparse_state;
+uint32_t sparse_remaining;
+
+void StartReceiveArea(void) {
+	current_address = kStartReceiveAddress;
+	erased_sectors = 0;
+	sparse_state = SPARSE_OFFSET;
+}
+
+//True if sector i reads all 0xFF, e.g. left erased by an earlier attempt
+static bool SectorIsBlank(uint8_t i) {
+	const uint32_t* words = (const uint32_t*)kSectorBaseAddress[i];
+	const uint32_t* end = (const uint32_t*)kSectorBaseAddress[i + 1];
+
+	FlashRAM_ResetDataCache();
+
+	while (words < end)
+		if (*words++ != 0xFFFFFFFF)
+			return false;
+	return true;
+}
+
+void EraseSectorAt(uint32_t address) {
+	uint8_t i = SectorIndex(address);
+
+	if (i < kNumSectors && address == kSectorBaseAddress[i] && !(erased_sectors & (1UL << i))) {
+	  if (!SectorIsBlank(i)) {
+		ShowFlashBusy(FLASH_JOB_ERASE, i, true);
+		FlashRAM_EraseSector(FlashSector(i));
+		ShowFlashBusy(FLASH_JOB_ERASE, i, false);
+	  }
+	  erased_sectors |= 1UL << i;
+	}
+}
+
+void EraseSectorsBefore(uint32_t end) {
+	for (uint8_t i = SectorIndex(current_address); i < kNumSectors && kSectorBaseAddress[i] < end; ++i)
+		EraseSectorAt(kSectorBaseAddress[i]);
+}
+
+void SkipErasedTo(uint32_t address) {
+	EraseSectorsBefore(address);
+	current_address = address;
+}
+
+uint16_t ProgramPage(const uint8_t* data, size_t size) {
+	uint16_t result = TLM_OK;
+
+	ShowFlashBusy(FLASH_JOB_PROGRAM, 0, true);
+
+	FlashRAM_Unlock();
+	EraseSectorAt(current_address);
+	const uint32_t* words = static_cast<const uint32_t*>(static_cast<const void*>(data));
+	for (size_t written = 0; written < size; written += 4) {
+		if (*words != 0xFFFFFFFF)
+			FlashRAM_ProgramWord(current_address, *words);
+		words++;
+		current_address += 4;
+		if (current_address>=EndOfMemory){
+			result = TLM_IMAGE_TOO_LARGE;
+			break;
+		}
+	}
+
+	ShowFlashBusy(FLASH_JOB_PROGRAM, 0, false);
+	return result;
+}
+
+uint16_t ProgramSparseBlock(const uint8_t* data, size_t size, uint32_t image_length) {
+	const uint32_t* words = static_cast<const uint32_t*>(static_cast<const void*>(data));
+	const uint32_t end_address = kStartReceiveAddress + image_length;
+	uint16_t result = TLM_OK;
+	uint32_t w;
+
+	ShowFlashBusy(FLASH_JOB_PROGRAM, 0, true);
+
+	FlashRAM_Unlock();
+
+	for (size_t read = 0; read < size && result == TLM_OK; read += 4) {
+		w = *words++;
+
+		switch (sparse_state) {
+			case SPARSE_OFFSET:
+				if (w == STREAM_SPARSE_END) {
+					sparse_state = SPARSE_DONE;
+				} else if ((w & 3) || w > image_length || (kStartReceiveAddress + w) < current_address) {
+					result = TLM_BAD_RECORD;
+				} else {
+					SkipErasedTo(kStartReceiveAddress + w);
+					sparse_state = SPARSE_LENGTH;
+				}
+				break;
+
+			case SPARSE_LENGTH:
+				if ((w & 3) || w > (end_address - current_address)) {
+					result = TLM_BAD_RECORD;
+				} else {
+					sparse_remaining = w;
+					sparse_state = w ? SPARSE_DATA : SPARSE_OFFSET;
+				}
+				break;
+
+			case SPARSE_DATA:
+				EraseSectorAt(current_address);
+				if (w != 0xFFFFFFFF)
+					FlashRAM_ProgramWord(current_address, w);
+				current_address += 4;
+				sparse_remaining -= 4;
+				if (!sparse_remaining)
+					sparse_state = SPARSE_OFFSET;
+				break;
+
+			case SPARSE_DONE: //padding up to the end of the page
+				break;
+		}
+	}
+
+	ShowFlashBusy(FLASH_JOB_PROGRAM, 0, false);
+	return result;
+}
+
+//Marks the application as incomplete until WriteImageInfo(), in case the copy is interrupted.
+//Programming 0 needs no erase, whatever was there before.
+void InvalidateImageInfo(void) {
+	FlashRAM_Unlock();
+	FlashRAM_ProgramWord(kImageInfoAddress, 0);
+	FlashRAM_ProgramWord(kImageInfoAddress + 4, 0);
+}
+
+//Copies all but the first kHeldVectorBytes, which are left erased until WriteHeldVectors(): until then
+//the application doesn't pass ApplicationIsValid(), whatever the image info record reads.
+void CopyMemory(uint32_t src_addr, uint32_t dst_addr, size_t size) {
+
+	FlashRAM_Unlock();
+
+
+	uint32_t sector_end = dst_addr;
+
+	for (size_t written = 0; written < size; written += 4) {
+
+		//Crossing into the next sector: erase it if dst_addr is its start
+		if (dst_addr >= sector_end) {
+			uint8_t i = SectorIndex(dst_addr);
+			if (i >= kNumSectors)
+				break;
+			if (dst_addr == kSectorBaseAddress[i]) {
+				ShowFlashBusy(FLASH_JOB_COPY_ERASE, i, true);
+				FlashRAM_EraseSector(FlashSector(i));
+				ShowFlashBusy(FLASH_JOB_COPY_ERASE, i, false);
+			}
+			sector_end = kSectorBaseAddress[i + 1];
+		}
+
+		//Boundary check
+		if (dst_addr > (kImageInfoAddress-4)) //Do not overwrite the image info or the receive buffer
+			break;
+
+		//Program the word (erased words are already 0xFFFFFFFF)
+		if (written >= kHeldVectorBytes && *(uint32_t*)src_addr != 0xFFFFFFFF)
+			FlashRAM_ProgramWord(dst_addr, *(uint32_t*)src_addr);
+
+		src_addr += 4;
+		dst_addr += 4;
+	}
+
+}
+
+void WriteImageInfo(uint32_t length, uint32_t crc) {
+	const uint32_t* info = (const uint32_t*)kImageInfoAddress;
+
+	FlashRAM_Unlock();
+
+	//If the new image did not reach the last sector, CopyMemory() did not erase it and InvalidateImageInfo() left 0s
+	if (info[0] != 0xFFFFFFFF || info[1] != 0xFFFFFFFF)
+		FlashRAM_EraseSector(FlashSector(kImageInfoSector));
+
+	FlashRAM_ProgramWord(kImageInfoAddress, length);
+	FlashRAM_ProgramWord(kImageInfoAddress + 4, crc);
+}
+
+//Last step of an update, after WriteImageInfo()
+void WriteHeldVectors(uint32_t src_addr, uint32_t dst_addr) {
+	FlashRAM_Unlock();
+	for (uint32_t i = 0; i < kHeldVectorBytes; i += 4)
+		FlashRAM_ProgramWord(dst_addr + i, *(uint32_t*)(src_addr + i));
+}
+
+uint32_t ImageLength(uint32_t addr, uint32_t size) {
+	const uint32_t* words = (const uint32_t*)addr;
+	uint32_t num_words = size / 4;
+
+	while (num_words && words[num_words - 1] == 0xFFFFFFFF)
+		num_words--;
+
+	return num_words * 4;
+}
+
+bool ImageInfoIs(uint32_t length, uint32_t crc) {
+	const uint32_t* info = (const uint32_t*)kImageInfoAddress;
+
+	return info[0] == length && info[1] == crc;
+}
+
+bool ApplicationIsValid(void) {
+	const uint32_t* vectors = (const uint32_t*)kStartExecutionAddress;
+	const uint32_t* info = (const uint32_t*)kImageInfoAddress;
+	uint32_t sp = vectors[0];
+	uint32_t reset = vectors[1];
+
+	if (!((sp > kRamStart && sp <= kRamEnd) || (sp > kCCMRamStart && sp <= kCCMRamEnd)))
+		return false;
+
+	//Reset_Handler must be Thumb code inside the execution area
+	if (!(reset & 1) || reset < kStartExecutionAddress || reset >= kImageInfoAddress)
+		return false;
+
+	//Not written by an update. An interrupted copy can't get here, its vectors are still erased
+	if (ImageInfoIs(0xFFFFFFFF, 0xFFFFFFFF))
+		return true;
+
+	//0 (copy interrupted before the vectors were erased), or not a length
+	if (!info[0] || (info[0] & 3) || info[0] > kMaxImageLength)
+		return false;
+
+	return HWCRC_Calc(vectors, info[0] / 4) == info[1];
+}
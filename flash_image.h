@@ -0,0 +1,114 @@
+/*
+ * flash_image.h - Writes the received image to the receive area, and installs it
+ *
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef FLASH_IMAGE_H_
+#define FLASH_IMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash_map.h"
+
+// The flash side of an update: the received data goes into the receive area (erasing each
+// sector before the first word is written to it), then it's checked and copied to the execution
+// area. The flash is erased and written through flash_ram.h, and the CRCs come from hw_crc.h.
+// The host tools build this file too, with host/flash_emulator.cc standing in for both.
+
+//The data is written a block at a time, in the page gap after it (STREAM_COMMIT: the sectors for
+//the next block are erased in that gap)
+const uint32_t kBlockSize = 16384;
+
+//Next address to be written in the receive area
+extern uint32_t current_address;
+
+//Bit i is set once sector i has been erased in this reception attempt
+extern uint32_t erased_sectors;
+
+//Record parser for sparse streams, see stream_header.h
+enum SparseState {
+  SPARSE_OFFSET,
+  SPARSE_LENGTH,
+  SPARSE_DATA,
+  SPARSE_DONE
+};
+extern SparseState sparse_state;
+
+//What the flash is busy with, see ShowFlashBusy()
+enum FlashJob {
+  FLASH_JOB_ERASE,			//A receive sector, ahead of the data
+  FLASH_JOB_PROGRAM,		//Data going into the receive area
+  FLASH_JOB_COPY_ERASE		//An execution sector, in CopyMemory()
+};
+
+//Defined by the user of this file (bootloader.cc shows it on the LEDs): called with busy set
+//before each job and cleared after it. sector is the one being erased.
+void ShowFlashBusy(FlashJob job, uint8_t sector, bool busy);
+
+//Starts a new reception attempt at kStartReceiveAddress
+void StartReceiveArea(void);
+
+//Erases the sector starting at address, unless it was already erased in this attempt or is still blank.
+//The flash must be unlocked. Audio capture keeps running meanwhile, see flash_ram.h
+void EraseSectorAt(uint32_t address);
+
+//Erases the sectors from current_address's up to the one holding end - 1
+void EraseSectorsBefore(uint32_t end);
+
+//Moves current_address forward over a range that's not sent, erasing the sectors it runs into.
+//Starts at current_address's own sector, which is not erased yet if nothing has been written at its base.
+void SkipErasedTo(uint32_t address);
+
+//Write size bytes at current_address. These return a TelemetryResult: TLM_OK, or why the data
+//can't be written
+uint16_t ProgramPage(const uint8_t* data, size_t size);
+
+//Same as ProgramPage(), for the records of a sparse stream of an image of image_length bytes.
+//Records can span blocks, the parser state is kept in sparse_state.
+uint16_t ProgramSparseBlock(const uint8_t* data, size_t size, uint32_t image_length);
+
+//Installing the image: InvalidateImageInfo(), CopyMemory(), WriteImageInfo() then WriteHeldVectors().
+//The first kHeldVectorBytes (the application's initial stack pointer and Reset_Handler) are only
+//written last, so an interrupted copy never passes ApplicationIsValid().
+const uint32_t kHeldVectorBytes = 8;
+
+void InvalidateImageInfo(void);
+void CopyMemory(uint32_t src_addr, uint32_t dst_addr, size_t size);
+void WriteImageInfo(uint32_t length, uint32_t crc);
+void WriteHeldVectors(uint32_t src_addr, uint32_t dst_addr);
+
+//Length of an image without the 0xFF padding at its end (the last block is padded out to kBlockSize)
+uint32_t ImageLength(uint32_t addr, uint32_t size);
+
+bool ImageInfoIs(uint32_t length, uint32_t crc);
+
+//Checks the application's vector table, and its CRC unless the image info record is erased.
+//Takes a few ms for a full size image, using the hardware CRC unit (HWCRC_Init() must be called first).
+bool ApplicationIsValid(void);
+
+#endif /* FLASH_IMAGE_H_ */
@@ -0,0 +1,127 @@
+/*
+ * flash_map.h - Flash layout of the bootloader, the application and the receive area
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef FLASH_MAP_H_
+#define FLASH_MAP_H_
+
+#include <stdint.h>
+
+// All constexpr, for FLASH_SIZE=1024 or 2048 (set by the Makefile). This header is also
+// compiled into the host tools (host/sector_map_test.cc checks both layouts), so it must
+// only use plain C++ types.
+
+#ifndef FLASH_SIZE
+#define FLASH_SIZE 1024
+#endif
+
+//Length and hardware CRC of the installed application, written at the end of the execution area
+//after every successful update. Both words are set to 0 before the copy starts. An erased record is
+//an application that was flashed some other way (st-flash, or installed by an older bootloader),
+//whose length and CRC aren't known.
+#if FLASH_SIZE == 2048
+//2MB parts are dual bank: the image is received into bank 2 while the bootloader runs from bank 1,
+//so erasing and writing it never stalls the core, and the application can have the rest of bank 1
+constexpr uint32_t kStartExecutionAddress =	0x08008000;
+constexpr uint32_t kStartReceiveAddress =	0x08100000;
+constexpr uint32_t EndOfMemory =			0x081FFFFC;
+constexpr uint32_t kImageInfoAddress =		0x080FFFF8;
+constexpr uint8_t kImageInfoSector =		11;
+constexpr uint8_t kNumSectors =				24;
+#elif FLASH_SIZE == 1024
+constexpr uint32_t kStartExecutionAddress =	0x08008000;
+constexpr uint32_t kStartReceiveAddress =	0x08080000;
+constexpr uint32_t EndOfMemory =			0x080FFFFC;
+constexpr uint32_t kImageInfoAddress =		0x0807FFF8;
+constexpr uint8_t kImageInfoSector =		7;
+constexpr uint8_t kNumSectors =				12;
+#else
+#error "FLASH_SIZE must be 1024 or 2048"
+#endif
+
+//Largest application: everything from kStartExecutionAddress up to the image info record
+constexpr uint32_t kMaxImageLength = kImageInfoAddress - kStartExecutionAddress;
+
+//Start of each sector, and the end of the last one
+constexpr uint32_t kSectorBaseAddress[kNumSectors + 1] = {
+  0x08000000,
+  0x08004000,
+  0x08008000,
+  0x0800C000,
+  0x08010000,
+  0x08020000,
+  0x08040000,
+  0x08060000,
+  0x08080000,
+  0x080A0000,
+  0x080C0000,
+  0x080E0000,
+#if FLASH_SIZE == 2048
+  0x08100000,
+  0x08104000,
+  0x08108000,
+  0x0810C000,
+  0x08110000,
+  0x08120000,
+  0x08140000,
+  0x08160000,
+  0x08180000,
+  0x081A0000,
+  0x081C0000,
+  0x081E0000,
+#endif
+  0x08000000 + FLASH_SIZE * 1024
+};
+
+//Sector holding address (kNumSectors if it's past the end), without searching the table:
+//each 1MB bank has four 16kB sectors, one 64kB and seven 128kB
+constexpr uint8_t SectorInBank(uint32_t offset) {
+	return offset < 0x10000 ? offset >> 14 : offset < 0x20000 ? 4 : 4 + (offset >> 17);
+}
+constexpr uint8_t SectorIndex(uint32_t address) {
+	return address >= kSectorBaseAddress[kNumSectors] ? kNumSectors
+		: ((address - 0x08000000) >> 20) * 12 + SectorInBank((address - 0x08000000) & 0xFFFFF);
+}
+constexpr uint32_t SectorSize(uint8_t i) {
+	return kSectorBaseAddress[i + 1] - kSectorBaseAddress[i];
+}
+
+//Both ends of every sector must map back to it
+constexpr bool SectorIndexMatchesTable(uint8_t i) {
+	return i == kNumSectors ||
+		(SectorIndex(kSectorBaseAddress[i]) == i && SectorIndex(kSectorBaseAddress[i + 1] - 4) == i
+		&& SectorIndexMatchesTable(i + 1));
+}
+static_assert(SectorIndexMatchesTable(0), "kSectorBaseAddress does not match SectorIndex()");
+static_assert(SectorIndex(kImageInfoAddress) == kImageInfoSector, "kImageInfoSector");
+
+//FLASH_Sector_x for sector i: the bank 2 sector numbers start at 16
+constexpr uint32_t FlashSector(uint8_t i) {
+	return (i < 12 ? i : i + 4) * 8;
+}
+
+#endif /* FLASH_MAP_H_ */
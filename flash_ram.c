@@ -0,0 +1,103 @@
+/*
+ * flash_ram.c - flash erase and write, run from SRAM
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include "flash_ram.h"
+#include "ramfunc.h"
+
+#define SECTOR_MASK ((uint32_t)0xFFFFFF07)
+
+void FlashRAM_Unlock(void)
+{
+	if (FLASH->CR & FLASH_CR_LOCK) {
+		FLASH->KEYR = FLASH_KEY1;
+		FLASH->KEYR = FLASH_KEY2;
+	}
+	FLASH->SR = FLASH_SR_EOP | FLASH_FLAG_OPERR | FLASH_SR_WRPERR |
+				FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR;
+}
+
+//Waits with everything but priority 0 interrupts masked, and returns the result like FLASH_GetStatus()
+RAMFUNC static FLASH_Status FlashRAM_Wait(void)
+{
+	uint32_t basepri = __get_BASEPRI();
+	uint32_t sr;
+
+	__set_BASEPRI(1 << (8 - __NVIC_PRIO_BITS));
+	while ((sr = FLASH->SR) & FLASH_SR_BSY) {;}
+	__set_BASEPRI(basepri);
+
+	if (sr & FLASH_SR_WRPERR) return FLASH_ERROR_WRP;
+	if (sr & (FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR)) return FLASH_ERROR_PROGRAM;
+	if (sr & FLASH_FLAG_OPERR) return FLASH_ERROR_OPERATION;
+	return FLASH_COMPLETE;
+}
+
+RAMFUNC FLASH_Status FlashRAM_EraseSector(uint32_t FLASH_Sector)
+{
+	FLASH_Status status = FlashRAM_Wait();
+
+	if (status == FLASH_COMPLETE) {
+		FLASH->CR &= CR_PSIZE_MASK;
+		FLASH->CR |= FLASH_PSIZE_WORD;
+		FLASH->CR &= SECTOR_MASK;
+		FLASH->CR |= FLASH_CR_SER | FLASH_Sector;
+		FLASH->CR |= FLASH_CR_STRT;
+
+		status = FlashRAM_Wait();
+
+		FLASH->CR &= (~FLASH_CR_SER);
+		FLASH->CR &= SECTOR_MASK;
+	}
+	return status;
+}
+
+RAMFUNC FLASH_Status FlashRAM_ProgramWord(uint32_t Address, uint32_t Data)
+{
+	FLASH_Status status = FlashRAM_Wait();
+
+	if (status == FLASH_COMPLETE) {
+		FLASH->CR &= CR_PSIZE_MASK;
+		FLASH->CR |= FLASH_PSIZE_WORD;
+		FLASH->CR |= FLASH_CR_PG;
+
+		*(__IO uint32_t*)Address = Data;
+
+		status = FlashRAM_Wait();
+
+		FLASH->CR &= (~FLASH_CR_PG);
+	}
+	return status;
+}
+
+void FlashRAM_ResetDataCache(void)
+{
+	FLASH->ACR &= ~FLASH_ACR_DCEN;
+	FLASH->ACR |= FLASH_ACR_DCRST;
+	FLASH->ACR &= ~FLASH_ACR_DCRST;
+	FLASH->ACR |= FLASH_ACR_DCEN;
+}
@@ -0,0 +1,48 @@
+/*
+ * flash_ram.h - flash erase and write, run from SRAM
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef FLASH_RAM_H_
+#define FLASH_RAM_H_
+
+#include "stm32f4xx.h"
+
+// FLASH_Unlock(), and FLASH_ClearFlag() of the EOP and error flags
+void FlashRAM_Unlock(void);
+
+// Same as FLASH_EraseSector() and FLASH_ProgramWord() with VoltageRange_3, but these run from SRAM.
+// While the flash is busy, only priority 0 interrupts are taken (the audio DMA), since their
+// handlers are in SRAM too: any other handler would stall the core until the flash is done.
+// The flash must be unlocked first, as with the StdPeriph functions.
+
+FLASH_Status FlashRAM_EraseSector(uint32_t FLASH_Sector);
+FLASH_Status FlashRAM_ProgramWord(uint32_t Address, uint32_t Data);
+
+// The data cache isn't updated by erases and writes: call this before reading back what was written
+void FlashRAM_ResetDataCache(void);
+
+#endif /* FLASH_RAM_H_ */
@@ -0,0 +1,110 @@
+// Copyright 2026 The smr-bootloader contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Band-pass prefilter for the slicer: a cascade of two biquads (direct form
+// I), a high-pass that takes out DC and mains hum, and a low-pass that takes
+// out the hiss above the FSK tones. Both are 2nd order Butterworth.
+//
+// The symbols are lengths in samples, so the tones sit at the same fraction
+// of the sample rate at 48k and 96k, and so do the corners: fs/256 (188Hz at
+// 48k) and fs/2.5 (19.2kHz at 48k). The fundamentals of the shortest and
+// longest runs of all the rates in kSymbolRates are fs/6 and fs/64. A lower
+// low-pass corner slows the edges down more than it takes noise out, and
+// decodes worse (see -i in host/fsk_encoder.cc).
+//
+// It works like CMSIS-DSP's arm_biquad_cas_df1_32x64_q31() with postShift 1:
+// coefficients {b0, b1, b2, a1, a2} in q30 (a1 and a2 negated), q31 state
+// and a 64-bit sum (SMLAL). The high-pass poles are too close to 1 for q15
+// coefficients and state (arm_biquad_cascade_df1_q15), which leave enough
+// of an offset and limit cycles at the output to move the slicer edges.
+//
+// Process() runs in the audio interrupt (see ramfunc.h), so the coefficients
+// are copied into the object by Init().
+//
+// Cost, counted from the source for the Cortex-M4 (not from the compiled
+// code): per biquad, 9 loads, a SMULL and four SMLAL (1 cycle each), 3
+// instructions for the shift, about 5 for the saturation and 4 stores, so
+// roughly 25 instructions and 30 cycles. With the call that's about 70 cycles
+// per channel, 140 per sample for both: 4% of the 3500 cycles per sample at
+// 168MHz and 48kHz, 8% at 96kHz and 16% at the idle clock (HCLK/4). A
+// PREFILTER=1 build measures it ("prefilter" in the telemetry report).
+
+#ifndef STM_AUDIO_BOOTLOADER_FSK_BAND_PASS_FILTER_H_
+#define STM_AUDIO_BOOTLOADER_FSK_BAND_PASS_FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ramfunc.h"
+
+namespace stm_audio_bootloader {
+
+const size_t kNumBiquads = 2;
+
+const int32_t kBandPassCoefficients[kNumBiquads][5] = {
+  { 1055267610, -2110535220, 1055267610, 2110217345, -1037111271 },  // fs/256
+  { 686060602, 1372121204, 686060602, -1227262514, -443238070 },  // fs/2.5
+};
+
+class BandPassFilter {
+ public:
+  BandPassFilter() { }
+  ~BandPassFilter() { }
+
+  void Init() {
+    memcpy(coefficients_, kBandPassCoefficients, sizeof(coefficients_));
+    memset(state_, 0, sizeof(state_));
+  }
+
+  RAMFUNC int16_t Process(int16_t sample) {
+    int32_t x = static_cast<int32_t>(sample) << 16;
+    for (size_t i = 0; i < kNumBiquads; ++i) {
+      const int32_t* c = coefficients_[i];
+      int32_t* s = state_[i];  // x[n-1], x[n-2], y[n-1], y[n-2]
+      int64_t acc = static_cast<int64_t>(c[0]) * x;
+      acc += static_cast<int64_t>(c[1]) * s[0];
+      acc += static_cast<int64_t>(c[2]) * s[1];
+      acc += static_cast<int64_t>(c[3]) * s[2];
+      acc += static_cast<int64_t>(c[4]) * s[3];
+      acc >>= 30;
+      int32_t y = acc > INT32_MAX ? INT32_MAX :
+          (acc < INT32_MIN ? INT32_MIN : static_cast<int32_t>(acc));
+      s[1] = s[0];
+      s[0] = x;
+      s[3] = s[2];
+      s[2] = y;
+      x = y;
+    }
+    return x >> 16;
+  }
+
+ private:
+  int32_t coefficients_[kNumBiquads][5];
+  int32_t state_[kNumBiquads][4];
+};
+
+}  // namespace stm_audio_bootloader
+
+#endif  // STM_AUDIO_BOOTLOADER_FSK_BAND_PASS_FILTER_H_
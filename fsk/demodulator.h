@@ -0,0 +1,333 @@
+// Copyright 2013 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+// Modified for SMR project: Dan Green (danngreen1@gmail.com) 2015
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// FSK demodulator. The slicer output (one bool per sample) is turned into
+// symbols by the time between transitions: 0 = zero, 1 = one, 2 = pause.
+//
+// This is the stm-audio-bootloader demodulator, kept in this tree so the host
+// tools (host/fsk_encoder.cc) can run the exact same code as the bootloader.
+//
+// Initialized with a list of rates instead of fixed symbol lengths, it finds
+// the rate from the first preamble: the last 4 pauses before it and its
+// first 8 symbols (zero, one, ...) must fit one of the rates. The pauses must
+// be within 1/4 of the rate's pause length, so hiss on a silent input (which
+// the band-pass prefilter leaves as short random runs, without the hum to
+// hold the slicer) can't pass for a preamble. Until then every run is
+// passed on as a pause, so the packet decoder just waits. Once found, the
+// rate is kept until the next Init().
+//
+// The decision thresholds follow the measured lengths of the zeros and ones
+// (a first order loop, 1/16 of the error per symbol), so a
+// playback clock that is off by a few percent still decodes. The symbols are
+// timed edge to edge, so there is no phase to lose and nothing to re-learn
+// after a gap: the demodulator runs on from Init() to the end of the stream,
+// and pages can follow each other with no gap between them.
+//
+// PushSample() and everything it calls run in the audio interrupt, from SRAM
+// on the bootloader (see ramfunc.h), so they only touch members: the rate
+// list is copied in by Init().
+//
+// The symbols wait in a ring for the packet decoder, which runs in the main
+// loop. The main loop is held up while the flash is busy, so the ring holds a
+// whole sector erase: 65536 symbols, 2 bits each (16kB, in CCM RAM on the
+// bootloader). Even at the fastest rate (12/6/3 at 96kHz) that's 3.1s of
+// symbols, against 2.4s for a 128kB erase and a block write at the datasheet
+// maximum; 8.2s at the default rate at 48kHz. If the ring fills anyway, new
+// symbols are dropped rather than overwriting unread ones, and any zero or
+// one dropped is counted by symbols_lost().
+
+#ifndef STM_AUDIO_BOOTLOADER_FSK_DEMODULATOR_H_
+#define STM_AUDIO_BOOTLOADER_FSK_DEMODULATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ramfunc.h"
+
+namespace stm_audio_bootloader {
+
+const size_t kSymbolBufferSize = 65536;
+static_assert((kSymbolBufferSize & (kSymbolBufferSize - 1)) == 0, "kSymbolBufferSize must be a power of two");
+
+// Nominal symbol lengths, in samples
+struct SymbolPeriods {
+  uint8_t pause;
+  uint8_t one;
+  uint8_t zero;
+};
+
+// Rates told apart by the preamble. The first one is what make fsk-wav uses,
+// and is reported by the period accessors until a preamble has been found.
+// The sums of 8 preamble runs (12 zero periods) are far enough apart that a
+// sample of jitter on the edges can't mistake one rate for another.
+const SymbolPeriods kSymbolRates[] = {
+  { 16, 8, 4 },
+  { 32, 16, 8 },
+  { 24, 12, 6 },
+  { 12, 6, 3 },
+};
+const size_t kNumSymbolRates = sizeof(kSymbolRates) / sizeof(kSymbolRates[0]);
+
+const size_t kRateDetectionRuns = 8;  // Preamble runs measured
+const size_t kRateDetectionPauses = 4;  // Pauses checked before them
+const uint32_t kMaxTrackingError = 4;  // The loop stays within 1/4 of nominal
+
+class Demodulator {
+ public:
+  Demodulator() { }
+  ~Demodulator() { }
+
+  // Arguments are the nominal symbol lengths, in samples.
+  void Init(uint32_t pause_period, uint32_t one_period, uint32_t zero_period) {
+    SymbolPeriods periods = {
+      static_cast<uint8_t>(pause_period),
+      static_cast<uint8_t>(one_period),
+      static_cast<uint8_t>(zero_period)
+    };
+    Configure(periods);
+    num_rates_ = 0;
+    detecting_ = false;
+    read_ptr_ = write_ptr_ = 0;
+    symbols_lost_ = 0;
+    Sync();
+  }
+
+  // Finds the rate from the first preamble, see above.
+  void Init(const SymbolPeriods* rates, size_t num_rates) {
+    Configure(rates[0]);
+    num_rates_ = num_rates < kNumSymbolRates ? num_rates : kNumSymbolRates;
+    for (size_t r = 0; r < num_rates_; ++r) {
+      rates_[r] = rates[r];
+    }
+    detecting_ = true;
+    read_ptr_ = write_ptr_ = 0;
+    symbols_lost_ = 0;
+    Sync();
+  }
+
+  // Drops the queued symbols, and reads the next few as pauses: the first
+  // runs after the capture starts are not whole symbols. Called by Init(),
+  // the receivers don't call it between blocks (the timing is kept through
+  // the page gap, and the queued symbols may already be the next packet's).
+  // The tracked symbol lengths are kept.
+  void Sync() {
+    read_ptr_ = write_ptr_;
+    previous_sample_ = false;
+    duration_ = 0;
+    swallow_ = 4;
+    num_runs_ = 0;
+  }
+
+  RAMFUNC void PushSample(bool sample) {
+    if (previous_sample_ == sample) {
+      ++duration_;
+    } else {
+      previous_sample_ = sample;
+      if (swallow_) {
+        Emit(2);
+        --swallow_;
+      } else if (detecting_) {
+        Detect(duration_);
+      } else {
+        uint8_t symbol = Classify(duration_);
+        Track(symbol, duration_);
+        Emit(symbol);
+      }
+      duration_ = 0;
+    }
+  }
+
+  inline size_t available() const {
+    return (write_ptr_ - read_ptr_) & (kSymbolBufferSize - 1);
+  }
+
+  inline uint8_t NextSymbol() {
+    size_t read_ptr = read_ptr_;
+    uint8_t symbol = (symbols_[read_ptr >> 2] >> ((read_ptr & 3) * 2)) & 3;
+    read_ptr_ = (read_ptr + 1) & (kSymbolBufferSize - 1);
+    return symbol;
+  }
+
+  // False while still looking for the first preamble
+  bool locked() const { return !detecting_; }
+
+  // Zeros and ones dropped because the ring was full, since Init()
+  uint32_t symbols_lost() const { return symbols_lost_; }
+
+  uint8_t pause_period() const { return periods_.pause; }
+  uint8_t one_period() const { return periods_.one; }
+  uint8_t zero_period() const { return periods_.zero; }
+
+ private:
+  // Run lengths are counted from 0, so each one reads a sample short.
+  // Tracked lengths are in 1/256 samples, thresholds in 1/16 samples.
+  RAMFUNC void Configure(const SymbolPeriods& periods) {
+    periods_ = periods;
+    zero_length_ = (periods.zero - 1) << 8;
+    one_length_ = (periods.one - 1) << 8;
+    UpdateThresholds();
+  }
+
+  // Halfway between the lengths, rounded up. The pause length is taken as
+  // a multiple of the one length, it is too long to track on its own.
+  RAMFUNC void UpdateThresholds() {
+    uint32_t zero = zero_length_ >> 4;
+    uint32_t one = one_length_ >> 4;
+    uint32_t pause = ((one + 16) * periods_.pause) / periods_.one - 16;
+    one_zero_threshold_ = ((zero + one) >> 1) + 8;
+    pause_one_threshold_ = ((one + pause) >> 1) + 8;
+  }
+
+  RAMFUNC inline uint8_t Classify(uint32_t duration) const {
+    if (duration > 0xffff) {
+      return 2;
+    }
+    duration <<= 4;
+    if (duration >= pause_one_threshold_) {
+      return 2;
+    } else if (duration >= one_zero_threshold_) {
+      return 1;
+    } else {
+      return 0;
+    }
+  }
+
+  RAMFUNC inline void Track(uint8_t symbol, uint32_t duration) {
+    if (symbol == 2) {
+      return;
+    }
+    uint32_t nominal = ((symbol ? periods_.one : periods_.zero) - 1) << 8;
+    uint32_t& length = symbol ? one_length_ : zero_length_;
+    int32_t error = static_cast<int32_t>(duration << 8) - static_cast<int32_t>(length);
+    length += error >> 4;
+    if (length > nominal + nominal / kMaxTrackingError) {
+      length = nominal + nominal / kMaxTrackingError;
+    } else if (length < nominal - nominal / kMaxTrackingError) {
+      length = nominal - nominal / kMaxTrackingError;
+    }
+    UpdateThresholds();
+  }
+
+  // Only this writes to symbols_, and only to the bits of the symbol at
+  // write_ptr_, so a byte that is also being read is never torn.
+  RAMFUNC inline void Emit(uint8_t symbol) {
+    size_t write_ptr = write_ptr_;
+    size_t next = (write_ptr + 1) & (kSymbolBufferSize - 1);
+    if (next == read_ptr_) {
+      if (symbol != 2) {
+        ++symbols_lost_;
+      }
+      return;
+    }
+    uint8_t shift = (write_ptr & 3) * 2;
+    uint8_t& packed = symbols_[write_ptr >> 2];
+    packed = (packed & ~(3 << shift)) | (symbol << shift);
+    write_ptr_ = next;
+  }
+
+  // runs_ must be kRateDetectionPauses pauses, then zero, one, zero, one...
+  RAMFUNC bool Matches(const SymbolPeriods& periods, uint32_t sum) {
+    // Run lengths are counted from 0, so each one reads a sample short
+    uint32_t expected = 12 * periods.zero - kRateDetectionRuns;
+    uint32_t error = sum > expected ? sum - expected : expected - sum;
+    if (error * 8 > 12 * periods.zero) {
+      return false;
+    }
+    uint32_t pause = periods.pause - 1;
+    for (size_t i = 0; i < kRateDetectionPauses; ++i) {
+      error = runs_[i] > pause ? runs_[i] - pause : pause - runs_[i];
+      if (error * 4 > periods.pause) {
+        return false;
+      }
+    }
+    Configure(periods);
+    for (size_t i = 0; i < kRateDetectionRuns; ++i) {
+      if (Classify(runs_[kRateDetectionPauses + i]) != (i & 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Keeps the last few runs, passing on the older ones as pauses, until they
+  // look like the start of a preamble at one of the rates. The kept runs are
+  // then passed on as symbols at that rate.
+  RAMFUNC void Detect(uint32_t duration) {
+    if (num_runs_ == kNumDetectionRuns) {
+      Emit(2);
+      for (size_t i = 0; i < kNumDetectionRuns - 1; ++i) {
+        runs_[i] = runs_[i + 1];
+      }
+      --num_runs_;
+    }
+    runs_[num_runs_++] = duration > 0xffff ? 0xffff : duration;
+    if (num_runs_ < kNumDetectionRuns) {
+      return;
+    }
+
+    uint32_t sum = 0;
+    for (size_t i = kRateDetectionPauses; i < kNumDetectionRuns; ++i) {
+      sum += runs_[i];
+    }
+    for (size_t r = 0; r < num_rates_; ++r) {
+      if (Matches(rates_[r], sum)) {
+        detecting_ = false;
+        for (size_t i = 0; i < num_runs_; ++i) {
+          Emit(Classify(runs_[i]));
+        }
+        num_runs_ = 0;
+        return;
+      }
+    }
+    Configure(rates_[0]);
+  }
+
+  bool previous_sample_;
+  uint32_t duration_;
+  uint32_t swallow_;
+  uint32_t pause_one_threshold_;
+  uint32_t one_zero_threshold_;
+  uint32_t zero_length_;
+  uint32_t one_length_;
+
+  SymbolPeriods periods_;
+  SymbolPeriods rates_[kNumSymbolRates];
+  size_t num_rates_;
+  bool detecting_;
+  static const size_t kNumDetectionRuns = kRateDetectionPauses + kRateDetectionRuns;
+  uint16_t runs_[kNumDetectionRuns];
+  size_t num_runs_;
+
+  uint8_t symbols_[kSymbolBufferSize / 4];  // 4 symbols per byte, the first in bits 0-1
+  volatile size_t read_ptr_;
+  volatile size_t write_ptr_;
+  volatile uint32_t symbols_lost_;
+};
+
+}  // namespace stm_audio_bootloader
+
+#endif  // STM_AUDIO_BOOTLOADER_FSK_DEMODULATOR_H_
@@ -0,0 +1,131 @@
+// Copyright 2013 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+// Modified for SMR project: Dan Green (danngreen1@gmail.com) 2015
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// FSK packet decoder.
+
+#include "fsk/packet_decoder.h"
+
+namespace stm_audio_bootloader {
+
+/* static */
+uint32_t PacketDecoder::Crc32(uint32_t crc, const uint8_t* data, size_t size) {
+  // Bitwise: a table would cost 1kB of the bootloader sector for no
+  // noticeable gain, a packet takes hundreds of ms to arrive.
+  crc = ~crc;
+  while (size--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; ++i) {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+void PacketDecoder::ParseSyncHeader(uint8_t symbol) {
+  if (!((1 << symbol) & expected_symbols_)) {
+    state_ = PACKET_DECODER_STATE_ERROR_SYNC;
+    return;
+  }
+
+  switch (symbol) {
+    case 2:
+      ++sync_blank_size_;
+      if (sync_blank_size_ >= max_sync_duration_ && packet_count_) {
+        state_ = PACKET_DECODER_STATE_END_OF_TRANSMISSION;
+        return;
+      }
+      expected_symbols_ = (1 << 0) | (1 << 1) | (1 << 2);
+      preamble_remaining_size_ = kPreambleSize;
+      break;
+
+    case 1:
+      expected_symbols_ = (1 << 0);
+      --preamble_remaining_size_;
+      break;
+
+    case 0:
+      expected_symbols_ = (1 << 1);
+      --preamble_remaining_size_;
+      break;
+  }
+
+  if (preamble_remaining_size_ == 0) {
+    state_ = PACKET_DECODER_STATE_DECODING_PACKET;
+    packet_size_ = 0;
+    symbol_count_ = 0;
+  }
+}
+
+// A byte is shifted in over 8 symbols, so there's nothing to clear between
+// bytes. The data goes to packet_, the CRC that follows it to crc_.
+void PacketDecoder::ParsePacket(uint8_t symbol) {
+  byte_ = (byte_ << 1) | symbol;
+  ++symbol_count_;
+  if (symbol_count_ == 8) {
+    symbol_count_ = 0;
+    if (packet_size_ < kPacketSize) {
+      packet_[packet_size_] = byte_;
+    } else {
+      crc_[packet_size_ - kPacketSize] = byte_;
+    }
+    ++packet_size_;
+    if (packet_size_ == kPacketSize + 4) {
+      uint32_t crc = Crc32(0, packet_, kPacketSize);
+      uint32_t expected_crc =
+          (static_cast<uint32_t>(crc_[0]) << 24) |
+          (static_cast<uint32_t>(crc_[1]) << 16) |
+          (static_cast<uint32_t>(crc_[2]) << 8) |
+          (static_cast<uint32_t>(crc_[3]) << 0);
+      state_ = crc == expected_crc
+          ? PACKET_DECODER_STATE_OK
+          : PACKET_DECODER_STATE_ERROR_CRC;
+      ++packet_count_;
+    }
+  }
+}
+
+PacketDecoderState PacketDecoder::ProcessSymbol(uint8_t symbol) {
+  switch (state_) {
+    case PACKET_DECODER_STATE_SYNCING:
+      ParseSyncHeader(symbol);
+      break;
+
+    case PACKET_DECODER_STATE_DECODING_PACKET:
+      if (symbol == 2) {
+        state_ = PACKET_DECODER_STATE_ERROR_SYNC;
+      } else {
+        ParsePacket(symbol);
+      }
+      break;
+
+    default:
+      break;
+  }
+  return state_;
+}
+
+}  // namespace stm_audio_bootloader
@@ -0,0 +1,125 @@
+// Copyright 2013 Olivier Gillet.
+//
+// Author: Olivier Gillet (ol.gillet@gmail.com)
+// Modified for SMR project: Dan Green (danngreen1@gmail.com) 2015
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// FSK packet decoder.
+//
+// A packet is a run of pauses, a preamble of alternating zeros and ones
+// (4 bytes of 0x55), kPacketSize bytes of data sent MSB first, then the
+// CRC32 (zlib polynomial) of the data, big-endian.
+// kMaxSyncDuration pauses in a row after at least one packet is the end of
+// the transmission. This must be longer than the gap after each page (1.1s,
+// 3300 pauses with the fsk-wav settings), which leaves time for a sector erase.
+// It is counted in pauses of 16 samples at 48kHz (1.33s); receivers using
+// another rate or pause period get the same time from MaxSyncDuration().
+
+#ifndef STM_AUDIO_BOOTLOADER_FSK_PACKET_DECODER_H_
+#define STM_AUDIO_BOOTLOADER_FSK_PACKET_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ramfunc.h"
+
+namespace stm_audio_bootloader {
+
+const uint16_t kPacketSize = 256;
+const uint16_t kMaxSyncDuration = 4000;  // Symbols
+const uint16_t kPreambleSize = 32;  // Symbols
+
+inline uint16_t MaxSyncDuration(uint32_t sample_rate, uint16_t pause_period) {
+  uint32_t duration = static_cast<uint32_t>(kMaxSyncDuration) *
+      (sample_rate / 1000) * 16 / (48 * pause_period);
+  return duration > 0xffff ? 0xffff : duration;
+}
+
+enum PacketDecoderState {
+  PACKET_DECODER_STATE_SYNCING,
+  PACKET_DECODER_STATE_DECODING_PACKET,
+  PACKET_DECODER_STATE_OK,
+  PACKET_DECODER_STATE_ERROR_SYNC,
+  PACKET_DECODER_STATE_ERROR_CRC,
+  PACKET_DECODER_STATE_END_OF_TRANSMISSION
+};
+
+class PacketDecoder {
+ public:
+  PacketDecoder() { }
+  ~PacketDecoder() { }
+
+  void Init(uint16_t max_sync_duration = kMaxSyncDuration) {
+    max_sync_duration_ = max_sync_duration;
+    packet_count_ = 0;
+    packet_ = NULL;
+    Reset();
+  }
+
+  // Where the next packet's data is written (kPacketSize bytes), as it is
+  // decoded: the receiver can point this at the packet's place in its block
+  // buffer instead of copying it there. It must be set before the packet
+  // starts, the data is only good once ProcessSymbol() returns OK.
+  void set_packet_buffer(uint8_t* buffer) {
+    packet_ = buffer;
+  }
+
+  // For receivers that only learn the pause period from the first packet
+  void set_max_sync_duration(uint16_t max_sync_duration) {
+    max_sync_duration_ = max_sync_duration;
+  }
+
+  void Reset() {
+    state_ = PACKET_DECODER_STATE_SYNCING;
+    expected_symbols_ = 0xff;
+    preamble_remaining_size_ = kPreambleSize;
+    sync_blank_size_ = 0;
+  }
+
+  HOTFUNC PacketDecoderState ProcessSymbol(uint8_t symbol);
+
+  const uint8_t* packet_data() const { return packet_; }
+
+  HOTFUNC static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size);
+
+ private:
+  HOTFUNC void ParseSyncHeader(uint8_t symbol);
+  HOTFUNC void ParsePacket(uint8_t symbol);
+
+  PacketDecoderState state_;
+  uint8_t expected_symbols_;
+  uint8_t preamble_remaining_size_;
+  uint16_t sync_blank_size_;
+  uint16_t max_sync_duration_;
+  uint16_t symbol_count_;
+  uint16_t packet_size_;
+  uint32_t packet_count_;
+  uint8_t byte_;
+  uint8_t* packet_;
+  uint8_t crc_[4];
+};
+
+}  // namespace stm_audio_bootloader
+
+#endif  // STM_AUDIO_BOOTLOADER_FSK_PACKET_DECODER_H_
@@ -0,0 +1,129 @@
+/*
+ * handoff.h - Bootloader-to-application handoff block, kept in backup SRAM
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include <stdint.h>
+
+// The bootloader fills this in right before jumping to the application.
+// The application can copy this header to read it (after enabling the BKPSRAM clock):
+//
+//	RCC->AHB1ENR |= RCC_AHB1ENR_BKPSRAMEN;
+//	if (HANDOFF->magic == HANDOFF_MAGIC && HANDOFF->version == HANDOFF_VERSION) ...
+//
+// Fields are only ever added to the end, and version is bumped when that happens.
+
+#define HANDOFF_ADDRESS		0x40024000	/* BKPSRAM_BASE */
+#define HANDOFF				((volatile BootloaderHandoff *)HANDOFF_ADDRESS)
+#define HANDOFF_MAGIC		0x48524D53	/* "SMRH" */
+#define HANDOFF_VERSION		10
+
+enum BootReason {
+	BOOT_REASON_NORMAL		= 0,	/* Button not held, application was valid */
+	BOOT_REASON_UPDATED		= 1,	/* An update was received and installed */
+	BOOT_REASON_USER_EXIT	= 2,	/* Update mode was left with the button, nothing installed */
+	BOOT_REASON_UP_TO_DATE	= 3		/* The stream header showed the image is already installed */
+};
+
+#define HANDOFF_FLAG_IMAGE_INVALID	(1 << 0)	/* Update mode was entered because the application failed validation */
+#define HANDOFF_FLAG_BUTTON_HELD	(1 << 1)	/* Update mode was entered with the button */
+
+#define HANDOFF_NUM_CLOCK_PROFILES	3	/* See clock_profile.h */
+
+//Audio interrupt load at one clock profile, from a make CLOCK_BENCHMARK=1 build. From version 8 on,
+//measured on a synthetic packet before the codec is started (see BenchmarkClockProfiles())
+typedef struct {
+	uint32_t core_clock_hz;			/* 0 if not measured */
+	uint32_t audio_cycles_budget;
+	uint32_t audio_cycles_avg;
+	uint32_t audio_cycles_max;
+	uint32_t audio_overruns;		/* Always 0 from version 8 on, there's no audio DMA to overrun */
+} HandoffClockBench;
+
+//Packet decoder load at one clock profile, on the same synthetic packet
+typedef struct {
+	uint32_t symbols;				/* Read from the demodulator ring, 0 if not measured or the packet didn't decode */
+	uint32_t cycles;				/* NextSymbol() and ProcessSymbol(), all symbols */
+	uint32_t cycles_max;			/* Slowest symbol: the packet's last one, which checks the CRC */
+	uint32_t crc_cycles;			/* PacketDecoder::Crc32() of one packet */
+} HandoffDecodeBench;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;					/* sizeof(BootloaderHandoff) */
+
+	uint32_t boot_reason;
+	uint32_t flags;
+
+	uint32_t bytes_received;		/* Data bytes of the last reception attempt */
+	uint32_t attempts;				/* Reception attempts (restarted after each error) */
+	uint32_t sync_errors;			/* Packet sync errors, all attempts */
+	uint32_t crc_errors;			/* Packet CRC errors, all attempts */
+
+	uint32_t reset_to_jump_cycles;	/* Reset to jump, no-update path only */
+	uint32_t startup_cycles;		/* Update mode, codec and LED driver bring-up until audio capture is running (Init() comes before, it restarts the counter) */
+	uint32_t wait_ms;				/* Start of the last attempt (capture running, or the retry) to its first good packet */
+	uint32_t receive_ms;			/* First good packet to end of transmission */
+	uint32_t program_ms;			/* Part of receive_ms spent writing to the receive sectors */
+	uint32_t copy_ms;				/* CRC, copy to the execution sectors, and verify */
+
+	uint32_t image_length;
+	uint32_t image_crc;				/* Hardware CRC unit (CRC-32/MPEG-2) of image_length bytes */
+
+	uint32_t image_version;			/* From the stream header, 0 if there was none */
+
+	uint32_t sample_rate;			/* Codec capture rate of the last reception */
+	uint32_t audio_cycles_budget;	/* Core cycles per sample at that rate */
+	uint32_t audio_cycles_avg;		/* Cycles per audio interrupt (one sample) in the slicer and demodulators */
+	uint32_t audio_cycles_max;
+
+	uint32_t audio_overruns;		/* Audio interrupts that came too late and lost a block of samples */
+
+	uint32_t core_clock_hz;			/* Core clock of the last reception */
+	HandoffClockBench clock_bench[HANDOFF_NUM_CLOCK_PROFILES];	/* Indexed by ClockProfile */
+
+	uint32_t input_gain;			/* Codec line input gain set by the AGC for the last reception, 1.5dB steps, 23 is 0dB */
+
+	uint32_t symbols_lost;			/* Zeros and ones the demodulators dropped because the main loop fell behind (e.g. an erase outlasting the page gap), last reception */
+
+	HandoffDecodeBench decode_bench[HANDOFF_NUM_CLOCK_PROFILES];	/* Indexed by ClockProfile */
+
+	uint32_t decode_symbols;		/* Symbols read by the main loop's packet decoders, last reception */
+	uint32_t decode_cycles;			/* Main loop cycles in NextSymbol(), ProcessSymbol() and StorePacket() for them, flash writes left out */
+	uint32_t decode_cycles_max;		/* Slowest symbol: a packet's last one, which checks the CRC */
+
+	uint32_t prefilter_cycles_avg;	/* Part of audio_cycles_avg in the band-pass prefilters, both channels (make PREFILTER=1, else 0) */
+	uint32_t prefilter_cycles_max;
+	uint32_t prefilter_bench_cycles[HANDOFF_NUM_CLOCK_PROFILES];	/* The same for clock_bench[].audio_cycles_avg */
+} BootloaderHandoff;
+
+void Handoff_Write(BootloaderHandoff *h);
+
+#endif /* HANDOFF_H_ */
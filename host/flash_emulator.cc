@@ -0,0 +1,128 @@
+// flash_emulator.cc - The STM32F427 flash and CRC unit, for flash_image.cc on the host
+//
+// Copyright 2026 The smr-bootloader contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+
+#include "host/flash_emulator.h"
+
+#include <sys/mman.h>
+
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include "flash_ram.h"
+#include "hw_crc.h"
+}
+#include "flash_map.h"
+
+const FlashTiming kFlashTimingTypical = { "typical", 250000, 550000, 1000000, 16 };
+const FlashTiming kFlashTimingMax = { "max", 500000, 1100000, 2000000, 100 };
+
+static const uint32_t kFlashBase = 0x08000000;
+static const uint32_t kFlashBytes = FLASH_SIZE * 1024;
+
+static uint8_t* flash = NULL;
+static FlashTiming timing;
+static uint32_t busy_us;
+static uint32_t errors;
+
+bool FlashEmulatorInit(const FlashTiming& t, uint8_t fill) {
+  if (!flash) {
+    void* p = mmap(reinterpret_cast<void*>(kFlashBase), kFlashBytes,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != reinterpret_cast<void*>(kFlashBase)) {
+      perror("mapping the flash at 0x08000000");
+      return false;
+    }
+    flash = static_cast<uint8_t*>(p);
+  }
+  memset(flash, fill, kFlashBytes);
+  timing = t;
+  busy_us = 0;
+  errors = 0;
+  return true;
+}
+
+uint32_t FlashEmulatorTakeBusyTime() {
+  uint32_t t = busy_us;
+  busy_us = 0;
+  return t;
+}
+
+uint32_t FlashEmulatorErrors() {
+  return errors;
+}
+
+void FlashRAM_Unlock(void) {
+}
+
+// FLASH_Sector_x is SNB << 3: sectors 0..11 in bank 1, 16..27 in bank 2
+FLASH_Status FlashRAM_EraseSector(uint32_t FLASH_Sector) {
+  uint32_t snb = FLASH_Sector >> 3;
+  uint8_t i = snb < 12 ? snb : snb - 4;
+  if ((FLASH_Sector & 7) || (snb >= 12 && snb < 16) || i >= kNumSectors) {
+    ++errors;
+    return FLASH_ERROR_PROGRAM;
+  }
+  uint32_t size = SectorSize(i);
+  memset(flash + kSectorBaseAddress[i] - kFlashBase, 0xff, size);
+  busy_us += size == 0x4000 ? timing.erase_16k
+      : size == 0x10000 ? timing.erase_64k : timing.erase_128k;
+  return FLASH_COMPLETE;
+}
+
+FLASH_Status FlashRAM_ProgramWord(uint32_t Address, uint32_t Data) {
+  if ((Address & 3) || Address < kFlashBase || Address - kFlashBase >= kFlashBytes) {
+    ++errors;
+    return FLASH_ERROR_PROGRAM;
+  }
+  uint32_t word;
+  memcpy(&word, flash + Address - kFlashBase, 4);
+  if ((word & Data) != Data) {
+    ++errors;
+  }
+  word &= Data;
+  memcpy(flash + Address - kFlashBase, &word, 4);
+  busy_us += timing.program_word;
+  return FLASH_COMPLETE;
+}
+
+void FlashRAM_ResetDataCache(void) {
+}
+
+void HWCRC_Init(void) {
+}
+
+// CRC-32/MPEG-2, a word at a time, see hw_crc.h
+uint32_t HWCRC_Calc(const uint32_t* data, uint32_t num_words) {
+  uint32_t crc = 0xffffffff;
+  while (num_words--) {
+    crc ^= *data++;
+    for (int bit = 0; bit < 32; ++bit) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+  }
+  return crc;
+}
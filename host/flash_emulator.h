@@ -0,0 +1,66 @@
+// flash_emulator.h - The STM32F427 flash and CRC unit, for flash_image.cc on the host
+//
+// Copyright 2026 The smr-bootloader contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// -----------------------------------------------------------------------------
+//
+// Stands in for flash_ram.c and hw_crc.c, so the bootloader's flash_image.cc
+// runs unchanged on the host: the flash is mapped at 0x08000000, where
+// flash_image.cc reads it through plain pointers, and FlashRAM_EraseSector()
+// and FlashRAM_ProgramWord() change it the way the hardware does (erasing
+// sets a sector to 0xff, programming can only clear bits) and add up how long
+// the flash would have been busy. Only one layout per build, FLASH_SIZE as
+// for the bootloader.
+
+#ifndef HOST_FLASH_EMULATOR_H_
+#define HOST_FLASH_EMULATOR_H_
+
+#include <stdint.h>
+
+// Erase and word program times at 2.7..3.6V (x32 parallelism), from the
+// STM32F427 datasheet, in microseconds
+struct FlashTiming {
+  const char* name;
+  uint32_t erase_16k;
+  uint32_t erase_64k;
+  uint32_t erase_128k;
+  uint32_t program_word;
+};
+
+extern const FlashTiming kFlashTimingTypical;
+extern const FlashTiming kFlashTimingMax;
+
+// Maps the flash if it's not mapped yet, and fills all of it with fill (what
+// was there before the update). Returns false if it can't be mapped.
+bool FlashEmulatorInit(const FlashTiming& timing, uint8_t fill);
+
+// Microseconds the flash was busy since the last call
+uint32_t FlashEmulatorTakeBusyTime();
+
+// Erases of invalid sectors, and words programmed over bits that weren't
+// erased, since FlashEmulatorInit()
+uint32_t FlashEmulatorErrors();
+
+#endif  // HOST_FLASH_EMULATOR_H_
@@ -0,0 +1,1207 @@
+// fsk_encoder.cc - Encodes a binary into a WAV file for the FSK audio bootloader
+//
+// Copyright 2026 The smr-bootloader contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Usage: fsk_encoder [options] input.bin
+//
+// Writes the same format as stm-audio-bootloader/fsk/encoder.py: 1s of
+// silence, 1s of pauses, the packets (with a gap of pauses after every page),
+// then the end of transmission: 3 times MaxSyncDuration() pauses, enough for
+// the decoder to see it even if a sector erase takes up the first part. The
+// signal is a full scale square wave, each symbol is the time between two
+// edges. Symbol periods are in samples, so -s 96000 with the same periods
+// makes a file half as long, for a bootloader built with SAMPLE_RATE=96000.
+//
+// Unless --no-header is given, the image is preceded by a stream header packet
+// (see stream_header.h) and a page gap. With --sparse, runs of 0xff in the
+// image are left out, and the rest is sent as (offset, length, data) records.
+// With --stereo, the packets alternate between the left and right channels of
+// a stereo file, see STREAM_FLAG_STEREO.
+//
+// Several parameter sets can be given with -x, to make a set of test files in
+// one go. With --verify, every file is decoded again with the demodulator and
+// packet decoder from fsk/ (the code the bootloader runs) and compared with
+// the input. -d and -i add copies of the signal with a playback clock error or
+// with the impairments of a cheap playback device; the impaired ones are
+// decoded with and without the band-pass prefilter (make PREFILTER=1).
+//
+// With --flash, the verified data is also written to an emulated flash by the
+// bootloader's own flash_image.cc (host/flash_emulator.cc), then copied to the
+// execution area and checked as after an update. The packet decoder waits for
+// as long as the flash would be busy, while the demodulator keeps filling its
+// ring, so a page gap too short for the erases shows up as lost symbols. The
+// time the decoder itself takes is not counted. Built for FLASH_SIZE=1024 by
+// default, like the bootloader.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fsk/band_pass_filter.h"
+#include "fsk/demodulator.h"
+#include "fsk/packet_decoder.h"
+#include "flash_image.h"
+#include "host/flash_emulator.h"
+#include "stream_header.h"
+
+extern "C" {
+#include "hw_crc.h"
+#include "telemetry.h"
+}
+
+using namespace stm_audio_bootloader;
+
+struct EncoderParameters {
+  uint32_t sample_rate;
+  uint32_t pause_period;
+  uint32_t one_period;
+  uint32_t zero_period;
+  uint32_t packet_size;
+  uint32_t page_size;
+  uint32_t blank_duration_ms;
+};
+
+// Same as the fsk-wav target in the Makefile
+static const EncoderParameters kDefaultParameters = {
+  48000, 16, 8, 4, 256, 16384, 1100
+};
+
+static const uint32_t kDefaultLoadAddress = 0x08008000;
+
+static const int16_t kFullScale = 32767;
+
+// Noise seeds tried at each -i level
+static const uint32_t kImpairmentRuns = 8;
+
+// Same as the STM32 CRC unit: CRC-32/MPEG-2, fed with little-endian words
+static uint32_t Stm32Crc(const uint8_t* data, size_t num_words) {
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < num_words; ++i, data += 4) {
+    crc ^= data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    for (int bit = 0; bit < 32; ++bit) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Shortest run of 0xffffffff words worth a new record (which costs 2 words)
+static const size_t kMinSparseGapWords = 4;
+
+static uint32_t GetWord(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static void PutWord(std::vector<uint8_t>* data, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    data->push_back((value >> (i * 8)) & 0xff);
+  }
+}
+
+// Records for everything but the runs of erased words, see stream_header.h
+static std::vector<uint8_t> MakeSparseStream(const std::vector<uint8_t>& image) {
+  std::vector<uint8_t> stream;
+  size_t num_words = image.size() / 4;
+  size_t start = 0;
+
+  while (start < num_words) {
+    // Skip erased words, then find the next gap long enough to end the record
+    while (start < num_words && GetWord(&image[start * 4]) == 0xffffffff) {
+      ++start;
+    }
+    if (start == num_words) {
+      break;
+    }
+    size_t end = start, gap = 0;
+    while (end + gap < num_words && gap < kMinSparseGapWords) {
+      if (GetWord(&image[(end + gap) * 4]) == 0xffffffff) {
+        ++gap;
+      } else {
+        end += gap + 1;
+        gap = 0;
+      }
+    }
+    PutWord(&stream, start * 4);
+    PutWord(&stream, (end - start) * 4);
+    stream.insert(stream.end(), image.begin() + start * 4, image.begin() + end * 4);
+    start = end;
+  }
+  PutWord(&stream, STREAM_SPARSE_END);
+  return stream;
+}
+
+// Rebuilds the image from the records, false if they are not valid
+static bool ReadSparseStream(
+    const std::vector<uint8_t>& stream,
+    uint32_t length,
+    std::vector<uint8_t>* image) {
+  image->assign(length, 0xff);
+  size_t position = 0;
+  uint32_t next_offset = 0;
+  while (position + 4 <= stream.size()) {
+    uint32_t offset = GetWord(&stream[position]);
+    if (offset == STREAM_SPARSE_END) {
+      return true;
+    }
+    if (position + 8 > stream.size()) {
+      return false;
+    }
+    uint32_t size = GetWord(&stream[position + 4]);
+    position += 8;
+    if ((offset & 3) || (size & 3) || offset < next_offset || offset > length ||
+        size > length - offset || position + size > stream.size()) {
+      return false;
+    }
+    std::copy(stream.begin() + position, stream.begin() + position + size,
+        image->begin() + offset);
+    position += size;
+    next_offset = offset + size;
+  }
+  return false;
+}
+
+static StreamHeader MakeHeader(
+    const std::vector<uint8_t>& image,
+    uint32_t stream_length,
+    uint32_t flags,
+    uint32_t target_id,
+    uint32_t image_version,
+    uint32_t load_address) {
+  StreamHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = STREAM_HEADER_MAGIC;
+  header.version = STREAM_HEADER_VERSION;
+  header.size = sizeof(StreamHeader);
+  header.target_id = target_id;
+  header.image_version = image_version;
+  header.length = image.size();
+  header.load_address = load_address;
+  header.flags = flags;
+  header.image_crc = Stm32Crc(&image[0], image.size() / 4);
+  header.stream_length = stream_length;
+  header.header_crc = Stm32Crc(
+      reinterpret_cast<const uint8_t*>(&header), STREAM_HEADER_CRC_WORDS);
+  return header;
+}
+
+class FskEncoder {
+ public:
+  FskEncoder(const EncoderParameters& parameters)
+      : p_(parameters), state_(kFullScale) { }
+
+  void CodeIntro() {
+    signal_.insert(signal_.end(), p_.sample_rate, 0);
+    CodeBlank(1.0);
+  }
+
+  // The header is a packet of its own, followed by a page gap
+  void CodeHeader(const StreamHeader& header) {
+    CodePacket(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    CodeGap();
+  }
+
+  void CodeGap() {
+    CodeBlank(p_.blank_duration_ms * 0.001);
+  }
+
+  void CodePauses(size_t count) {
+    Encode(std::vector<uint8_t>(count, 2));
+  }
+
+  void CodeOutro() {
+    Encode(std::vector<uint8_t>(3 * max_sync_duration(), 2));
+  }
+
+  // Number of pauses in the gap after a page
+  // Pauses the bootloader takes as the end of the transmission
+  size_t max_sync_duration() const {
+    return MaxSyncDuration(p_.sample_rate, p_.pause_period);
+  }
+
+  size_t gap_symbols() const {
+    return NumBlankSymbols(p_.blank_duration_ms * 0.001);
+  }
+
+  void Code(std::vector<uint8_t> data) {
+    if (data.size() % p_.page_size) {
+      data.insert(data.end(), p_.page_size - (data.size() % p_.page_size), 0xff);
+    }
+    // Same arithmetic as encoder.py, so the gaps have the same length
+    uint32_t packets_per_page = p_.page_size / p_.packet_size;
+    uint32_t num_packets_written = 0;
+
+    for (size_t offset = 0; offset < data.size(); offset += p_.packet_size) {
+      size_t size = data.size() - offset;
+      if (size > p_.packet_size) {
+        size = p_.packet_size;
+      }
+      CodePacket(&data[offset], size);
+      if (++num_packets_written == packets_per_page) {
+        CodeGap();
+        num_packets_written = 0;
+      }
+    }
+  }
+
+  void CodePacket(const uint8_t* data, size_t size) {
+    std::vector<uint8_t> bytes = PacketBytes(data, size);
+    std::vector<uint8_t> symbols;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+      for (int bit = 7; bit >= 0; --bit) {
+        symbols.push_back((bytes[i] >> bit) & 1);
+      }
+    }
+    Encode(symbols);
+  }
+
+  // Number of samples CodePacket() would add
+  size_t PacketLength(const uint8_t* data, size_t size) const {
+    std::vector<uint8_t> bytes = PacketBytes(data, size);
+    size_t length = 0;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+      for (int bit = 7; bit >= 0; --bit) {
+        length += (bytes[i] >> bit) & 1 ? p_.one_period : p_.zero_period;
+      }
+    }
+    return length;
+  }
+
+  size_t length() const { return signal_.size(); }
+  const std::vector<int16_t>& signal() const { return signal_; }
+
+ private:
+  void Encode(const std::vector<uint8_t>& symbols) {
+    const uint32_t durations[3] = { p_.zero_period, p_.one_period, p_.pause_period };
+    for (size_t i = 0; i < symbols.size(); ++i) {
+      signal_.insert(signal_.end(), durations[symbols[i]], state_);
+      state_ = -state_;
+    }
+  }
+
+  size_t NumBlankSymbols(double duration) const {
+    return static_cast<size_t>(duration * p_.sample_rate / p_.pause_period) + 1;
+  }
+
+  void CodeBlank(double duration) {
+    Encode(std::vector<uint8_t>(NumBlankSymbols(duration), 2));
+  }
+
+  // Preamble, data padded to the packet size, CRC
+  std::vector<uint8_t> PacketBytes(const uint8_t* data, size_t size) const {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(p_.packet_size + 8);
+    bytes.insert(bytes.end(), 4, 0x55);
+    bytes.insert(bytes.end(), data, data + size);
+    bytes.insert(bytes.end(), p_.packet_size - size, 0);
+    uint32_t crc = PacketDecoder::Crc32(0, &bytes[4], p_.packet_size);
+    bytes.push_back(crc >> 24);
+    bytes.push_back((crc >> 16) & 0xff);
+    bytes.push_back((crc >> 8) & 0xff);
+    bytes.push_back(crc & 0xff);
+    return bytes;
+  }
+
+  EncoderParameters p_;
+  int16_t state_;
+  std::vector<int16_t> signal_;
+};
+
+// Two encoders, one per channel. The header goes on the left channel, then
+// even packets go on the left and odd ones on the right. A page takes longer
+// on the channel with more ones in it, so the other channel gets pauses
+// spread before its packets and both halves of the page end together.
+class StereoFskEncoder {
+ public:
+  StereoFskEncoder(const EncoderParameters& parameters)
+      : p_(parameters), left_(parameters), right_(parameters), max_pause_(0) { }
+
+  void CodeIntro() {
+    left_.CodeIntro();
+    right_.CodeIntro();
+  }
+
+  void CodeHeader(const StreamHeader& header) {
+    left_.CodePacket(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    right_.CodePauses((left_.length() - right_.length()) / p_.pause_period);
+    left_.CodeGap();
+    right_.CodeGap();
+  }
+
+  void CodeOutro() {
+    left_.CodeOutro();
+    right_.CodeOutro();
+  }
+
+  void Code(std::vector<uint8_t> data) {
+    if (data.size() % p_.page_size) {
+      data.insert(data.end(), p_.page_size - (data.size() % p_.page_size), 0xff);
+    }
+    FskEncoder* channels[2] = { &left_, &right_ };
+    uint32_t packets_per_channel = p_.page_size / p_.packet_size / 2;
+
+    for (size_t page = 0; page < data.size(); page += p_.page_size) {
+      // Lengths are measured from the signal so far, which also takes back
+      // the rounding of the pauses on the previous pages.
+      size_t end[2] = { left_.length(), right_.length() };
+      for (size_t offset = 0; offset < p_.page_size; offset += p_.packet_size) {
+        size_t ch = (offset / p_.packet_size) & 1;
+        end[ch] += channels[ch]->PacketLength(&data[page + offset], p_.packet_size);
+      }
+      size_t late = end[1] > end[0] ? 1 : 0;
+      size_t early = 1 - late;
+      size_t pauses = (end[late] - end[early]) / p_.pause_period;
+
+      for (size_t offset = 0; offset < p_.page_size; offset += p_.packet_size) {
+        size_t ch = (offset / p_.packet_size) & 1;
+        if (ch == early) {
+          size_t index = offset / p_.packet_size / 2;
+          size_t count = pauses / packets_per_channel +
+              (index < pauses % packets_per_channel ? 1 : 0);
+          channels[ch]->CodePauses(count);
+          max_pause_ = std::max(max_pause_, count);
+        }
+        channels[ch]->CodePacket(&data[page + offset], p_.packet_size);
+      }
+      left_.CodeGap();
+      right_.CodeGap();
+    }
+  }
+
+  // Longest run of pauses added before a packet
+  size_t max_pause() const { return max_pause_; }
+
+  std::vector<std::vector<int16_t> > signals() const {
+    std::vector<std::vector<int16_t> > signals;
+    signals.push_back(left_.signal());
+    signals.push_back(right_.signal());
+    size_t length = std::max(left_.length(), right_.length());
+    signals[0].resize(length, 0);
+    signals[1].resize(length, 0);
+    return signals;
+  }
+
+ private:
+  EncoderParameters p_;
+  FskEncoder left_;
+  FskEncoder right_;
+  size_t max_pause_;
+};
+
+static void Put16(FILE* fp, uint16_t value) {
+  fputc(value & 0xff, fp);
+  fputc(value >> 8, fp);
+}
+
+static void Put32(FILE* fp, uint32_t value) {
+  Put16(fp, value & 0xffff);
+  Put16(fp, value >> 16);
+}
+
+// One signal per channel, all of the same length
+static bool WriteWav(
+    const char* file_name,
+    uint32_t sample_rate,
+    const std::vector<std::vector<int16_t> >& signals) {
+  FILE* fp = fopen(file_name, "wb");
+  if (!fp) {
+    perror(file_name);
+    return false;
+  }
+  uint16_t num_channels = signals.size();
+  uint32_t data_size = signals[0].size() * num_channels * 2;
+  fwrite("RIFF", 1, 4, fp);
+  Put32(fp, 36 + data_size);
+  fwrite("WAVEfmt ", 1, 8, fp);
+  Put32(fp, 16);
+  Put16(fp, 1);  // PCM
+  Put16(fp, num_channels);
+  Put32(fp, sample_rate);
+  Put32(fp, sample_rate * num_channels * 2);
+  Put16(fp, num_channels * 2);
+  Put16(fp, 16);
+  fwrite("data", 1, 4, fp);
+  Put32(fp, data_size);
+  for (size_t i = 0; i < signals[0].size(); ++i) {
+    for (size_t ch = 0; ch < num_channels; ++ch) {
+      Put16(fp, signals[ch][i]);
+    }
+  }
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+// The signals as captured by a codec whose clock is ppm slower than the
+// playback device's (ppm > 0 makes the symbols shorter). Nearest sample, so
+// the edges also get up to a sample of jitter.
+static std::vector<std::vector<int16_t> > Drift(
+    const std::vector<std::vector<int16_t> >& signals,
+    int32_t ppm) {
+  double step = 1.0 + ppm * 1e-6;
+  size_t length = static_cast<size_t>(signals[0].size() / step);
+  std::vector<std::vector<int16_t> > captured(signals.size());
+  for (size_t ch = 0; ch < signals.size(); ++ch) {
+    captured[ch].resize(length);
+    for (size_t i = 0; i < length; ++i) {
+      size_t source = static_cast<size_t>(i * step);
+      captured[ch][i] = signals[ch][std::min(source, signals[ch].size() - 1)];
+    }
+  }
+  return captured;
+}
+
+// The signals as played by a cheap device: at half scale, with the edges
+// smoothed by a one-pole low-pass at fs/5, then 50Hz hum (with some 150Hz)
+// at db below full scale, and white noise 12dB under that. There's no DC,
+// the codec's ADC high-pass filter takes it out.
+// The same seed gives the same noise.
+static std::vector<std::vector<int16_t> > Impair(
+    const std::vector<std::vector<int16_t> >& signals,
+    uint32_t sample_rate,
+    int32_t db,
+    uint32_t seed) {
+  double level = kFullScale * pow(10.0, -abs(db) / 20.0);
+  double smoothing = 1.0 - exp(-2 * M_PI / 5);
+  std::vector<std::vector<int16_t> > impaired(signals.size());
+  for (size_t ch = 0; ch < signals.size(); ++ch) {
+    double smoothed = 0;
+    impaired[ch].resize(signals[ch].size());
+    for (size_t i = 0; i < signals[ch].size(); ++i) {
+      double t = static_cast<double>(i) / sample_rate;
+      double noise = 0;
+      for (int n = 0; n < 4; ++n) {  // Roughly gaussian, unit variance
+        seed = seed * 1664525 + 1013904223;
+        noise += (seed >> 8) / 16777216.0 - 0.5;
+      }
+      noise *= sqrt(3.0);
+      smoothed += smoothing * (signals[ch][i] * 0.5 - smoothed);
+      double s = smoothed + level * (sin(2 * M_PI * 50 * t) +
+          0.5 * sin(2 * M_PI * 150 * t) + 0.25 * noise);
+      impaired[ch][i] = static_cast<int16_t>(
+          std::max(-32768.0, std::min(32767.0, floor(s + 0.5))));
+    }
+  }
+  return impaired;
+}
+
+// One line of Verify() results, nothing if label is NULL
+static void Report(const char* label, const char* format, ...) {
+  if (!label) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  printf("  %s: ", label);
+  vprintf(format, args);
+  va_end(args);
+}
+
+// How Verify() stores the decoded data, see --flash
+struct FlashOptions {
+  const FlashTiming* timing;  // NULL: only compare the decoded data
+  bool stream_commit;         // as a bootloader built with STREAM_COMMIT=1
+};
+
+static const FlashOptions kNoFlash = { NULL, false };
+
+// Fill for the flash before each run: all of it was written by the last
+// update, so every sector has to be erased
+static const uint8_t kOldFlashContents = 0x00;
+
+// flash_image.cc's LED hook, nothing to show here
+void ShowFlashBusy(FlashJob, uint8_t, bool) {
+}
+
+// Stores the decoded data the way bootloader.cc does, with flash_image.cc on
+// the flash emulator, and keeps track of how long the flash held up the main
+// loop. The demodulators run on meanwhile, their ring has to hold the symbols.
+class FlashWriter {
+ public:
+  FlashWriter(const FlashOptions& options, uint32_t sample_rate)
+      : options_(options),
+        sample_rate_(sample_rate),
+        stall_end_(0),
+        busy_us_(0),
+        longest_us_(0),
+        copy_us_(0),
+        committed_(0),
+        error_(TLM_OK) { }
+
+  bool enabled() const { return options_.timing != NULL; }
+
+  bool Init() {
+    if (!FlashEmulatorInit(*options_.timing, kOldFlashContents)) {
+      return false;
+    }
+    StartReceiveArea();
+    return true;
+  }
+
+  // Samples up to stall_end() are only demodulated, not decoded
+  size_t stall_end() const { return stall_end_; }
+
+  // STREAM_COMMIT: the first block is erased when the capture starts
+  void Start() {
+    if (options_.stream_commit) {
+      EraseSectorsBefore(current_address + kBlockSize);
+      Stall(0);
+    }
+  }
+
+  // The header is followed by a page gap for the first receive sector
+  void Header(size_t sample) {
+    EraseSectorAt(kStartReceiveAddress);
+    Stall(sample);
+  }
+
+  // A packet went into slot of the block, which is done if last is set
+  void Packet(size_t sample, const std::vector<uint8_t>& block, uint32_t slot, bool last,
+      const StreamHeader* header) {
+    if (options_.stream_commit) {
+      ready_.resize(block.size() / kPacketSize);
+      ready_[slot] = true;
+      while (error_ == TLM_OK && ready_[committed_ % ready_.size()]) {
+        ready_[committed_ % ready_.size()] = false;
+        Program(&block[(committed_ % ready_.size()) * kPacketSize], kPacketSize, header);
+        ++committed_;
+      }
+      if (last) {
+        EraseSectorsBefore(current_address + kBlockSize);
+      }
+    } else if (last) {
+      Program(&block[0], block.size(), header);
+    }
+    Stall(sample);
+  }
+
+  // What the bootloader does at the end of transmission: checks the received
+  // image, copies it to the execution area and checks the copy. Returns the
+  // reason it fails, or NULL.
+  const char* Install(const StreamHeader* header) {
+    uint32_t length;
+    FlashEmulatorTakeBusyTime();
+    if (error_ != TLM_OK) {
+      return "the data couldn't be written to the receive area";
+    }
+    if (header) {
+      length = header->length;
+    } else {
+      length = ImageLength(kStartReceiveAddress, current_address - kStartReceiveAddress);
+    }
+    if (length > kMaxImageLength) {
+      return "the image is too large";
+    }
+    if (header && (header->flags & STREAM_FLAG_SPARSE)) {
+      if (sparse_state != SPARSE_DONE) {
+        return "the sparse records don't end";
+      }
+      SkipErasedTo(kStartReceiveAddress + length);
+    }
+    if (length > current_address - kStartReceiveAddress) {
+      return "the image is truncated";
+    }
+    uint32_t crc = HWCRC_Calc(reinterpret_cast<const uint32_t*>(kStartReceiveAddress), length / 4);
+    if (header && crc != header->image_crc) {
+      return "the received image doesn't match the header CRC";
+    }
+    InvalidateImageInfo();
+    CopyMemory(kStartReceiveAddress, kStartExecutionAddress, length);
+    WriteImageInfo(length, crc);
+    WriteHeldVectors(kStartReceiveAddress, kStartExecutionAddress);
+    copy_us_ = FlashEmulatorTakeBusyTime();
+    if (FlashEmulatorErrors()) {
+      return "words were programmed without an erase";
+    }
+    if (!ApplicationIsValid() || !ImageInfoIs(length, crc)) {
+      return "the copy doesn't pass ApplicationIsValid()";
+    }
+    return NULL;
+  }
+
+  const char* timing_name() const { return options_.timing->name; }
+  double busy_seconds() const { return busy_us_ / 1e6; }
+  double longest_ms() const { return longest_us_ / 1e3; }
+  double copy_seconds() const { return copy_us_ / 1e6; }
+
+ private:
+  void Program(const uint8_t* data, size_t size, const StreamHeader* header) {
+    if (error_ != TLM_OK) {
+      return;
+    }
+    if (header && (header->flags & STREAM_FLAG_SPARSE)) {
+      error_ = ProgramSparseBlock(data, size, header->length);
+    } else {
+      error_ = ProgramPage(data, size);
+    }
+  }
+
+  void Stall(size_t sample) {
+    uint32_t us = FlashEmulatorTakeBusyTime();
+    busy_us_ += us;
+    longest_us_ = std::max(longest_us_, us);
+    stall_end_ = sample + 1 + static_cast<uint64_t>(us) * sample_rate_ / 1000000;
+  }
+
+  FlashOptions options_;
+  uint32_t sample_rate_;
+  size_t stall_end_;
+  uint64_t busy_us_;
+  uint32_t longest_us_;
+  uint32_t copy_us_;
+  uint32_t committed_;
+  uint16_t error_;
+  std::vector<bool> ready_;
+};
+
+// Runs the signals through the bootloader's slicer, demodulator and packet
+// decoder, restarting the packet decoders after every page and placing the
+// packets of a stereo stream the way bootloader.cc does. The demodulators run
+// on from the first sample to the last, as in the bootloader. Only complete
+// pages are kept. With flash.timing set, the pages are also written to the
+// emulated flash and installed, and the packet decoders wait while the flash
+// is busy (see FlashWriter).
+static bool Verify(
+    const char* label,
+    const EncoderParameters& p,
+    const std::vector<std::vector<int16_t> >& signals,
+    const std::vector<uint8_t>& data,
+    const std::vector<uint8_t>& image,
+    bool has_header,
+    bool prefilter,
+    const FlashOptions& flash) {
+  if (p.packet_size != kPacketSize) {
+    Report(label, "skipped, the decoder only reads %u byte packets\n", kPacketSize);
+    return true;
+  }
+  FlashWriter writer(flash, p.sample_rate);
+  if (writer.enabled() && p.page_size != kBlockSize) {
+    Report(label, "skipped, the bootloader writes %u byte pages\n", kBlockSize);
+    return true;
+  }
+  if (writer.enabled() && !writer.Init()) {
+    return false;
+  }
+
+  size_t num_channels = signals.size();
+  BandPassFilter filters[2];
+  Demodulator demodulators[2];
+  PacketDecoder decoders[2];
+  uint8_t packets[2][kPacketSize];
+  bool last_sample[2] = { false, false };
+  uint32_t channel_packets[2] = { 0, 0 };
+  std::vector<uint8_t> page(p.page_size);
+  std::vector<uint8_t> decoded;
+  uint32_t packets_per_page = p.page_size / p.packet_size;
+  uint32_t packet_index = 0;
+  bool header_pending = has_header;
+  StreamHeader header;
+  bool sparse = false;
+  bool stereo = false;
+  uint32_t length = 0;
+  size_t most_queued = 0;
+  bool done = false;
+
+  // Zeros and ones dropped because the decoder fell behind
+  uint32_t symbols_lost = 0;
+
+  for (size_t ch = 0; ch < num_channels; ++ch) {
+    filters[ch].Init();
+    demodulators[ch].Init(kSymbolRates, kNumSymbolRates);
+    decoders[ch].Init(MaxSyncDuration(p.sample_rate, p.pause_period));
+    decoders[ch].set_packet_buffer(packets[ch]);
+    decoders[ch].Reset();
+    demodulators[ch].Sync();
+  }
+  writer.Start();
+
+  for (size_t i = 0; i < signals[0].size() && !done; ++i) {
+    for (size_t ch = 0; ch < num_channels; ++ch) {
+      int16_t s = prefilter ? filters[ch].Process(signals[ch][i]) : signals[ch][i];
+      last_sample[ch] = last_sample[ch] ? s >= -300 : s > 400;
+      demodulators[ch].PushSample(last_sample[ch]);
+    }
+    if (i < writer.stall_end()) {
+      continue;
+    }
+
+    for (size_t ch = 0; ch < (stereo ? 2 : 1) && !done; ++ch) {
+      Demodulator& demodulator = demodulators[ch];
+      PacketDecoder& decoder = decoders[ch];
+      most_queued = std::max(most_queued, demodulator.available());
+      while (demodulator.available() && !done && i >= writer.stall_end()) {
+        PacketDecoderState state = decoder.ProcessSymbol(demodulator.NextSymbol());
+        switch (state) {
+          case PACKET_DECODER_STATE_OK:
+            decoder.set_max_sync_duration(
+                MaxSyncDuration(p.sample_rate, demodulator.pause_period()));
+            if (header_pending) {
+              memcpy(&header, decoder.packet_data(), sizeof(header));
+              if (header.magic != STREAM_HEADER_MAGIC || header.header_crc != Stm32Crc(
+                  reinterpret_cast<const uint8_t*>(&header), STREAM_HEADER_CRC_WORDS)) {
+                Report(label, "FAILED, bad stream header\n");
+                return false;
+              }
+              sparse = header.flags & STREAM_FLAG_SPARSE;
+              stereo = header.flags & STREAM_FLAG_STEREO;
+              length = header.length;
+              header_pending = false;
+              if (stereo && num_channels < 2) {
+                Report(label, "FAILED, stereo header in a mono signal\n");
+                return false;
+              }
+              for (size_t c = 0; c < num_channels; ++c) {
+                decoders[c].Reset();
+              }
+              if (writer.enabled()) {
+                writer.Header(i);
+              }
+              break;
+            }
+            {
+              uint32_t slot = packet_index % packets_per_page;
+              if (stereo) {
+                if (channel_packets[ch] >=
+                    (packet_index / packets_per_page + 1) * (packets_per_page / 2)) {
+                  Report(label, "FAILED, channel %u got ahead at packet %u\n",
+                      static_cast<unsigned>(ch), packet_index);
+                  return false;
+                }
+                slot = (channel_packets[ch] * 2 + ch) % packets_per_page;
+                ++channel_packets[ch];
+              }
+              memcpy(&page[slot * kPacketSize], decoder.packet_data(), kPacketSize);
+              if (writer.enabled()) {
+                writer.Packet(i, page, slot, (packet_index + 1) % packets_per_page == 0,
+                    has_header ? &header : NULL);
+              }
+            }
+            if (++packet_index % packets_per_page == 0) {
+              decoded.insert(decoded.end(), page.begin(), page.end());
+              for (size_t c = 0; c < num_channels; ++c) {
+                decoders[c].Reset();
+              }
+            } else {
+              decoder.Reset();
+            }
+            break;
+
+          case PACKET_DECODER_STATE_ERROR_SYNC:
+          case PACKET_DECODER_STATE_ERROR_CRC:
+            for (size_t c = 0; c < num_channels; ++c) {
+              symbols_lost += demodulators[c].symbols_lost();
+            }
+            Report(label, "FAILED, %s error in packet %u on channel %u, %u symbols lost\n",
+                state == PACKET_DECODER_STATE_ERROR_CRC ? "crc" : "sync",
+                packet_index, static_cast<unsigned>(ch), symbols_lost);
+            return false;
+
+          case PACKET_DECODER_STATE_END_OF_TRANSMISSION:
+            // The right channel ends at the same time
+            done = ch == 0;
+            break;
+
+          default:
+            break;
+        }
+      }
+    }
+  }
+
+  if (!done) {
+    Report(label, "FAILED, no end of transmission\n");
+    return false;
+  }
+  if (sparse) {
+    std::vector<uint8_t> rebuilt;
+    if (!ReadSparseStream(decoded, length, &rebuilt) || rebuilt != image) {
+      Report(label, "FAILED, sparse records don't rebuild the image\n");
+      return false;
+    }
+  } else if (decoded.size() < data.size() ||
+      memcmp(&decoded[0], &data[0], data.size())) {
+    Report(label, "FAILED, decoded data differs from the input\n");
+    return false;
+  }
+  if (!writer.enabled()) {
+    Report(label, "ok, %u packets\n", packet_index);
+    return true;
+  }
+
+  for (size_t ch = 0; ch < num_channels; ++ch) {
+    symbols_lost += demodulators[ch].symbols_lost();
+  }
+  const char* install_error = writer.Install(has_header ? &header : NULL);
+  if (!install_error && memcmp(reinterpret_cast<const void*>(kStartExecutionAddress),
+      &image[0], image.size())) {
+    install_error = "the execution area differs from the image";
+  }
+  if (install_error || symbols_lost) {
+    Report(label, "FAILED, %s\n", install_error ? install_error : "symbols were lost");
+    return false;
+  }
+  Report(label, "ok, %u packets, flash busy %.1f s (%s times, longest %.0f ms), "
+      "up to %u symbols queued, copy %.1f s\n", packet_index, writer.busy_seconds(),
+      writer.timing_name(), writer.longest_ms(), static_cast<unsigned>(most_queued),
+      writer.copy_seconds());
+  return true;
+}
+
+// Intro, header, data and outro, one signal per channel
+static std::vector<std::vector<int16_t> > EncodeStream(
+    const EncoderParameters& p,
+    const StreamHeader* header,
+    const std::vector<uint8_t>& data,
+    bool stereo,
+    size_t* max_pause) {
+  if (stereo) {
+    StereoFskEncoder encoder(p);
+    encoder.CodeIntro();
+    encoder.CodeHeader(*header);
+    encoder.Code(data);
+    encoder.CodeOutro();
+    *max_pause = encoder.max_pause();
+    return encoder.signals();
+  }
+  FskEncoder encoder(p);
+  encoder.CodeIntro();
+  if (header) {
+    encoder.CodeHeader(*header);
+  }
+  encoder.Code(data);
+  encoder.CodeOutro();
+  *max_pause = 0;
+  return std::vector<std::vector<int16_t> >(1, encoder.signal());
+}
+
+// The bootloader only reads the rates it can find from the preamble
+static bool IsSupportedRate(const EncoderParameters& p) {
+  for (size_t i = 0; i < kNumSymbolRates; ++i) {
+    if (p.pause_period == kSymbolRates[i].pause &&
+        p.one_period == kSymbolRates[i].one &&
+        p.zero_period == kSymbolRates[i].zero) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool ParseSet(const char* arg, EncoderParameters* p) {
+  std::string s(arg);
+  size_t start = 0;
+  while (start < s.size()) {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos) {
+      end = s.size();
+    }
+    std::string item = s.substr(start, end - start);
+    if (item.size() < 3 || item[1] != '=') {
+      return false;
+    }
+    uint32_t value = strtoul(item.c_str() + 2, NULL, 0);
+    switch (item[0]) {
+      case 's': p->sample_rate = value; break;
+      case 'b': p->pause_period = value; break;
+      case 'n': p->one_period = value; break;
+      case 'z': p->zero_period = value; break;
+      case 'p': p->packet_size = value; break;
+      case 'g': p->page_size = value; break;
+      case 'k': p->blank_duration_ms = value; break;
+      default: return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+static bool Check(const EncoderParameters& p) {
+  return p.sample_rate && p.zero_period && p.zero_period < p.one_period &&
+      p.one_period < p.pause_period && p.packet_size &&
+      p.page_size >= p.packet_size && (p.page_size % p.packet_size) == 0;
+}
+
+static void Usage(const char* name) {
+  fprintf(stderr,
+      "Usage: %s [options] input.bin\n"
+      "  -s RATE   sample rate (%u)\n"
+      "  -b N      pause period, samples (%u)\n"
+      "  -n N      one period, samples (%u)\n"
+      "  -z N      zero period, samples (%u)\n"
+      "  -p N      packet size, bytes (%u)\n"
+      "  -g N      page size, bytes (%u)\n"
+      "  -k MS     gap after each page, ms (%u)\n"
+      "  -o FILE   output file (input.wav)\n"
+      "  -t ID     target ID in the stream header (0x%08X)\n"
+      "  -v N      image version in the stream header (0)\n"
+      "  -a ADDR   load address in the stream header (0x%08X)\n"
+      "  --no-header  leave out the stream header\n"
+      "  --sparse  leave out runs of 0xff (needs the stream header)\n"
+      "  --stereo  send half of the packets on the right channel (needs the\n"
+      "            stream header)\n"
+      "  -x SET    add a parameter set, e.g. -x s=96000,b=32,n=16,z=8\n"
+      "            (can be repeated, unset values come from the options above;\n"
+      "            files are named after the output file and the parameters)\n"
+      "  --verify  decode every file again and compare with the input\n"
+      "  -d PPM    also verify with the playback clock off by PPM, e.g. -d -1000\n"
+      "            (can be repeated)\n"
+      "  -i DB     also verify with smoothed edges, and hum and hiss DB below\n"
+      "            full scale, with and without the prefilter, e.g. -i 12 (can\n"
+      "            be repeated)\n"
+      "  --flash   verify by writing the data to an emulated flash and\n"
+      "            installing it, as the bootloader does, with typical erase and\n"
+      "            program times (--flash-max: the datasheet maximum). The decoder\n"
+      "            waits while the flash is busy. Not with -i\n"
+      "  --stream-commit  with --flash, write each packet as it's received (a\n"
+      "            bootloader built with STREAM_COMMIT=1)\n",
+      name,
+      kDefaultParameters.sample_rate, kDefaultParameters.pause_period,
+      kDefaultParameters.one_period, kDefaultParameters.zero_period,
+      kDefaultParameters.packet_size, kDefaultParameters.page_size,
+      kDefaultParameters.blank_duration_ms,
+      STREAM_TARGET_SMR, kDefaultLoadAddress);
+}
+
+int main(int argc, char** argv) {
+  EncoderParameters base = kDefaultParameters;
+  std::vector<std::string> set_args;
+  std::string input_file, output_file;
+  bool verify = false;
+  std::vector<int32_t> drifts;
+  std::vector<int32_t> impairments;
+  bool header = true;
+  bool sparse = false;
+  bool stereo = false;
+  FlashOptions flash = kNoFlash;
+  uint32_t target_id = STREAM_TARGET_SMR;
+  uint32_t image_version = 0;
+  uint32_t load_address = kDefaultLoadAddress;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    uint32_t* option = NULL;
+    if (arg == "--verify") {
+      verify = true;
+      continue;
+    } else if (arg == "--no-header") {
+      header = false;
+      continue;
+    } else if (arg == "--sparse") {
+      sparse = true;
+      continue;
+    } else if (arg == "--stereo") {
+      stereo = true;
+      continue;
+    } else if (arg == "--flash" || arg == "--flash-max") {
+      flash.timing = arg == "--flash" ? &kFlashTimingTypical : &kFlashTimingMax;
+      verify = true;
+      continue;
+    } else if (arg == "--stream-commit") {
+      flash.stream_commit = true;
+      continue;
+    } else if (arg[0] != '-') {
+      input_file = arg;
+      continue;
+    } else if (i + 1 >= argc || arg.size() != 2) {
+      Usage(argv[0]);
+      return 1;
+    }
+    switch (arg[1]) {
+      case 's': option = &base.sample_rate; break;
+      case 'b': option = &base.pause_period; break;
+      case 'n': option = &base.one_period; break;
+      case 'z': option = &base.zero_period; break;
+      case 'p': option = &base.packet_size; break;
+      case 'g': option = &base.page_size; break;
+      case 'k': option = &base.blank_duration_ms; break;
+      case 't': option = &target_id; break;
+      case 'v': option = &image_version; break;
+      case 'a': option = &load_address; break;
+      case 'o': output_file = argv[++i]; continue;
+      case 'x': set_args.push_back(argv[++i]); continue;
+      case 'd': drifts.push_back(strtol(argv[++i], NULL, 0)); verify = true; continue;
+      case 'i': impairments.push_back(strtol(argv[++i], NULL, 0)); verify = true; continue;
+      default: Usage(argv[0]); return 1;
+    }
+    *option = strtoul(argv[++i], NULL, 0);
+  }
+  if (input_file.empty()) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<EncoderParameters> sets;
+  for (size_t i = 0; i < set_args.size(); ++i) {
+    EncoderParameters p = base;
+    if (!ParseSet(set_args[i].c_str(), &p)) {
+      fprintf(stderr, "Bad parameter set: %s\n", set_args[i].c_str());
+      return 1;
+    }
+    sets.push_back(p);
+  }
+  if (sets.empty()) {
+    sets.push_back(base);
+  }
+
+  FILE* fp = fopen(input_file.c_str(), "rb");
+  if (!fp) {
+    perror(input_file.c_str());
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  fclose(fp);
+  if (data.empty()) {
+    fprintf(stderr, "%s is empty\n", input_file.c_str());
+    return 1;
+  }
+  if (sparse && !header) {
+    fprintf(stderr, "--sparse needs the stream header\n");
+    return 1;
+  }
+  if (stereo && !header) {
+    fprintf(stderr, "--stereo needs the stream header\n");
+    return 1;
+  }
+  if (flash.stream_commit && !flash.timing) {
+    fprintf(stderr, "--stream-commit needs --flash or --flash-max\n");
+    return 1;
+  }
+  if (flash.stream_commit && sparse) {
+    fprintf(stderr, "A STREAM_COMMIT bootloader doesn't take --sparse\n");
+    return 1;
+  }
+  if (flash.timing) {
+    printf("flash: %uMB, received at 0x%08X, installed at 0x%08X, up to %u bytes\n",
+        FLASH_SIZE / 1024, kStartReceiveAddress, kStartExecutionAddress, kMaxImageLength);
+  }
+
+  // The image is sent padded with 0xff, the header covers it up to the next word
+  std::vector<uint8_t> image(data);
+  image.insert(image.end(), (4 - image.size() % 4) % 4, 0xff);
+  std::vector<uint8_t> payload = sparse ? MakeSparseStream(image) : data;
+  uint32_t flags = (sparse ? STREAM_FLAG_SPARSE : 0) | (stereo ? STREAM_FLAG_STEREO : 0);
+  StreamHeader stream_header = MakeHeader(
+      image, payload.size(), flags, target_id, image_version, load_address);
+
+  if (output_file.empty()) {
+    output_file = input_file;
+    size_t dot = output_file.rfind('.');
+    if (dot != std::string::npos && output_file.find('/', dot) == std::string::npos) {
+      output_file.erase(dot);
+    }
+    output_file += ".wav";
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < sets.size(); ++i) {
+    const EncoderParameters& p = sets[i];
+    if (!Check(p)) {
+      fprintf(stderr, "Bad parameters: periods must be zero < one < pause, "
+          "the page size a multiple of the packet size\n");
+      return 1;
+    }
+    if (stereo && (p.page_size / p.packet_size) % 2) {
+      fprintf(stderr, "Bad parameters: --stereo needs an even number of "
+          "packets per page\n");
+      return 1;
+    }
+
+    std::string file_name = output_file;
+    if (!set_args.empty()) {
+      char suffix[96];
+      snprintf(suffix, sizeof(suffix), "-s%u-b%u-n%u-z%u-p%u-g%u-k%u",
+          p.sample_rate, p.pause_period, p.one_period, p.zero_period,
+          p.packet_size, p.page_size, p.blank_duration_ms);
+      size_t dot = file_name.rfind(".wav");
+      file_name.insert(dot == std::string::npos ? file_name.size() : dot, suffix);
+    }
+
+    FskEncoder encoder(p);
+    if (!IsSupportedRate(p)) {
+      fprintf(stderr, "Warning: the bootloader doesn't know the symbol periods "
+          "%u/%u/%u (see kSymbolRates in fsk/demodulator.h)\n",
+          p.pause_period, p.one_period, p.zero_period);
+    }
+    if (encoder.gap_symbols() >= encoder.max_sync_duration()) {
+      fprintf(stderr, "Warning: the gap after each page is %u pauses, the "
+          "bootloader will take it as the end of the transmission (%u)\n",
+          static_cast<unsigned>(encoder.gap_symbols()),
+          static_cast<unsigned>(encoder.max_sync_duration()));
+    }
+    size_t max_pause;
+    std::vector<std::vector<int16_t> > signals = EncodeStream(
+        p, header ? &stream_header : NULL, payload, stereo, &max_pause);
+    if (encoder.gap_symbols() < encoder.max_sync_duration() &&
+        encoder.gap_symbols() + max_pause >= encoder.max_sync_duration()) {
+      fprintf(stderr, "Warning: the channels drift apart by up to %u pauses per "
+          "packet, the bootloader will take a gap as the end of the transmission\n",
+          static_cast<unsigned>(max_pause));
+    }
+
+    double seconds = static_cast<double>(signals[0].size()) / p.sample_rate;
+    printf("%s: %.1f s, %.0f B/s\n", file_name.c_str(), seconds, data.size() / seconds);
+    if (sparse) {
+      std::vector<std::vector<int16_t> > full = EncodeStream(
+          p, &stream_header, data, stereo, &max_pause);
+      double full_seconds = static_cast<double>(full[0].size()) / p.sample_rate;
+      printf("  sparse: %u of %u bytes sent, %d bytes and %.1f s saved\n",
+          static_cast<unsigned>(payload.size()), static_cast<unsigned>(image.size()),
+          static_cast<int>(image.size()) - static_cast<int>(payload.size()),
+          full_seconds - seconds);
+    }
+    if (!WriteWav(file_name.c_str(), p.sample_rate, signals)) {
+      return 1;
+    }
+    if (verify) {
+      ok = Verify("verify", p, signals, data, image, header, false, flash) && ok;
+      for (size_t d = 0; d < drifts.size(); ++d) {
+        char label[32];
+        snprintf(label, sizeof(label), "verify %+d ppm", drifts[d]);
+        ok = Verify(label, p, Drift(signals, drifts[d]), data, image, header, false, flash) && ok;
+      }
+      // Only reported: the point is to compare the two
+      for (size_t d = 0; d < impairments.size(); ++d) {
+        uint32_t decoded = 0, prefiltered = 0;
+        for (uint32_t run = 1; run <= kImpairmentRuns; ++run) {
+          std::vector<std::vector<int16_t> > impaired = Impair(
+              signals, p.sample_rate, impairments[d], run);
+          decoded += Verify(NULL, p, impaired, data, image, header, false, kNoFlash);
+          prefiltered += Verify(NULL, p, impaired, data, image, header, true, kNoFlash);
+        }
+        printf("  verify -%d dB impaired: %u of %u ok, %u prefiltered\n",
+            abs(impairments[d]), decoded, kImpairmentRuns, prefiltered);
+      }
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+// sector_map_test.cc - Checks the flash layout in flash_map.h
+//
+// Copyright 2026 The smr-bootloader contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Usage: sector_map_test
+//
+// Built once per layout (make host-tools builds sector_map_test_1024 and
+// sector_map_test_2048, and every firmware build runs both). Compiling it
+// checks the static_asserts in flash_map.h for that FLASH_SIZE, running it
+// checks SectorIndex() against a search of kSectorBaseAddress for every word
+// of the flash, the sector sizes and bank 2 numbering against the reference
+// manual, and where the image info record and the receive area are.
+// Exits with 1 and a line per problem if anything is off.
+
+#include <cstdio>
+
+#include "stm32f4xx.h"  // FLASH_Sector_x, from the StdPeriph flash driver
+#include "flash_map.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what, uint32_t value) {
+  if (!ok) {
+    printf("FLASH_SIZE=%d: %s (0x%08X)\n", FLASH_SIZE, what, value);
+    ++failures;
+  }
+}
+
+// What SectorIndex() replaced: a search of the table
+static uint8_t SearchSector(uint32_t address) {
+  for (uint8_t i = 0; i < kNumSectors; ++i) {
+    if (address >= kSectorBaseAddress[i] && address < kSectorBaseAddress[i + 1]) {
+      return i;
+    }
+  }
+  return kNumSectors;
+}
+
+// RM0090, "Flash module organization": per 1MB bank, 4 x 16kB, 64kB, 7 x 128kB
+static uint32_t ExpectedSectorSize(uint8_t i) {
+  uint8_t in_bank = i % 12;
+  return in_bank < 4 ? 0x4000 : in_bank == 4 ? 0x10000 : 0x20000;
+}
+
+static const uint32_t kFlashSectors[24] = {
+  FLASH_Sector_0, FLASH_Sector_1, FLASH_Sector_2, FLASH_Sector_3,
+  FLASH_Sector_4, FLASH_Sector_5, FLASH_Sector_6, FLASH_Sector_7,
+  FLASH_Sector_8, FLASH_Sector_9, FLASH_Sector_10, FLASH_Sector_11,
+  FLASH_Sector_12, FLASH_Sector_13, FLASH_Sector_14, FLASH_Sector_15,
+  FLASH_Sector_16, FLASH_Sector_17, FLASH_Sector_18, FLASH_Sector_19,
+  FLASH_Sector_20, FLASH_Sector_21, FLASH_Sector_22, FLASH_Sector_23,
+};
+
+int main() {
+  const uint32_t flash_end = 0x08000000 + FLASH_SIZE * 1024;
+
+  Check(kSectorBaseAddress[0] == 0x08000000, "flash doesn't start at 0x08000000", kSectorBaseAddress[0]);
+  Check(kSectorBaseAddress[kNumSectors] == flash_end, "sectors don't end at the end of the flash",
+      kSectorBaseAddress[kNumSectors]);
+  for (uint8_t i = 0; i < kNumSectors; ++i) {
+    Check(SectorSize(i) == ExpectedSectorSize(i), "sector size", i);
+    Check(FlashSector(i) == kFlashSectors[i], "FlashSector() isn't FLASH_Sector_x", i);
+  }
+
+  for (uint32_t address = 0x08000000; address < flash_end; address += 4) {
+    if (SectorIndex(address) != SearchSector(address)) {
+      Check(false, "SectorIndex() differs from the table", address);
+      break;
+    }
+  }
+  Check(SectorIndex(flash_end) == kNumSectors, "SectorIndex() past the end", flash_end);
+  Check(SectorIndex(0xFFFFFFFC) == kNumSectors, "SectorIndex() past the end", 0xFFFFFFFC);
+
+  // The bootloader has sector 0, the application starts at sector 2
+  Check(kStartExecutionAddress == kSectorBaseAddress[2], "execution area", kStartExecutionAddress);
+
+  // The image info record is the last 8 bytes of the execution area, the receive
+  // area starts at a sector (erased as it goes) and holds the largest image
+  Check(kImageInfoAddress + 8 == kSectorBaseAddress[kImageInfoSector + 1], "image info record",
+      kImageInfoAddress);
+  Check(kStartReceiveAddress == kSectorBaseAddress[SectorIndex(kStartReceiveAddress)], "receive area",
+      kStartReceiveAddress);
+  Check(kStartReceiveAddress >= kImageInfoAddress + 8, "receive area overlaps the execution area",
+      kStartReceiveAddress);
+  Check(EndOfMemory == flash_end - 4, "EndOfMemory", EndOfMemory);
+  Check(EndOfMemory - kStartReceiveAddress >= kMaxImageLength, "receive area too small",
+      EndOfMemory - kStartReceiveAddress);
+
+#if FLASH_SIZE == 2048
+  // Received into bank 2, so the bootloader never waits for its own bank
+  Check(kStartReceiveAddress == 0x08100000, "receive area not at the start of bank 2", kStartReceiveAddress);
+  Check(kMaxImageLength == 992 * 1024 - 8, "largest image isn't 992kB", kMaxImageLength);
+#else
+  Check(kMaxImageLength == 480 * 1024 - 8, "largest image isn't 480kB", kMaxImageLength);
+#endif
+
+  if (!failures) {
+    printf("FLASH_SIZE=%d: %u sectors ok, largest image %u bytes\n", FLASH_SIZE,
+        static_cast<unsigned>(kNumSectors), kMaxImageLength);
+  }
+  return failures ? 1 : 0;
+}
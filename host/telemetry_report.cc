@@ -0,0 +1,278 @@
+// telemetry_report.cc - Prints the update telemetry ring from a backup SRAM dump
+//
+// Copyright 2026 The smr-bootloader contributors
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Usage: telemetry_report bkpsram.bin
+//
+// The input is a raw dump of the backup SRAM starting at 0x40024000 (dump-bkpsram in .gdbinit),
+// or a dump of just the telemetry ring. Both the host and the STM32 are little-endian,
+// so the structs are read straight from the file.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../handoff.h"
+#include "../telemetry.h"
+
+static const char* kResultNames[TLM_NUM_RESULTS] = {
+  "in progress",
+  "ok",
+  "sync error",
+  "crc error",
+  "image too large",
+  "verify failed",
+  "bad header",
+  "wrong target",
+  "truncated",
+  "already installed",
+  "bad record",
+};
+
+static const char* kBootReasonNames[] = {
+  "normal",
+  "updated",
+  "user exit",
+  "up to date",
+};
+
+static const char* ResultName(uint16_t result) {
+  return result < TLM_NUM_RESULTS ? kResultNames[result] : "unknown";
+}
+
+static const char* kClockProfileNames[HANDOFF_NUM_CLOCK_PROFILES] = {
+  "idle",
+  "normal",
+  "fast",
+};
+
+static void PrintClockBench(const BootloaderHandoff& h) {
+  bool measured = false;
+  for (int p = 0; p < HANDOFF_NUM_CLOCK_PROFILES; ++p) {
+    measured |= h.clock_bench[p].core_clock_hz != 0;
+  }
+  if (!measured) {
+    return;
+  }
+
+  // Up to version 7 this was measured with the codec running, from version 8 on
+  // it's a synthetic packet played before the codec starts: no overruns
+  printf("Audio interrupt load per clock profile (cycles per sample%s):\n",
+      h.version >= 8 ? ", synthetic packet" : "");
+  // From version 10 on, the part of avg in the prefilters, in a make PREFILTER=1 build
+  bool prefiltered = false;
+  for (int p = 0; h.version >= 10 && p < HANDOFF_NUM_CLOCK_PROFILES; ++p) {
+    prefiltered = prefiltered || h.prefilter_bench_cycles[p];
+  }
+  printf("%8s %5s %7s %7s %7s %6s",
+      "profile", "MHz", "budget", "avg", "max", "load");
+  if (prefiltered) {
+    printf(" %9s", "prefilter");
+  }
+  printf(h.version >= 8 ? "\n" : " %9s\n", "overruns");
+  for (int p = 0; p < HANDOFF_NUM_CLOCK_PROFILES; ++p) {
+    const HandoffClockBench& b = h.clock_bench[p];
+    if (!b.core_clock_hz || !b.audio_cycles_budget) {
+      continue;
+    }
+    printf("%8s %5u %7u %7u %7u %5u%%",
+        kClockProfileNames[p], b.core_clock_hz / 1000000, b.audio_cycles_budget,
+        b.audio_cycles_avg, b.audio_cycles_max,
+        100 * b.audio_cycles_avg / b.audio_cycles_budget);
+    if (prefiltered) {
+      printf(" %9u", h.prefilter_bench_cycles[p]);
+    }
+    if (h.version < 8) {
+      printf(" %9u", b.audio_overruns);
+    }
+    printf("\n");
+  }
+  printf("\n");
+
+  if (h.version < 8) {
+    return;
+  }
+  printf("Packet decoder per clock profile (cycles per symbol, synthetic packet):\n");
+  printf("%8s %8s %8s %8s %8s %9s\n",
+      "profile", "symbols", "avg", "max", "crc", "packet us");
+  for (int p = 0; p < HANDOFF_NUM_CLOCK_PROFILES; ++p) {
+    const HandoffDecodeBench& d = h.decode_bench[p];
+    const uint32_t mhz = h.clock_bench[p].core_clock_hz / 1000000;
+    if (!mhz) {
+      continue;
+    }
+    if (!d.symbols) {
+      printf("%8s  the packet didn't decode\n", kClockProfileNames[p]);
+      continue;
+    }
+    printf("%8s %8u %8u %8u %8u %9u\n",
+        kClockProfileNames[p], d.symbols, d.cycles / d.symbols, d.cycles_max,
+        d.crc_cycles, d.cycles / mhz);
+  }
+  printf("\n");
+}
+
+static void PrintHandoff(const BootloaderHandoff& h) {
+  printf("Last handoff (version %u):\n", h.version);
+  printf("  boot reason        %s\n",
+      h.boot_reason < 4 ? kBootReasonNames[h.boot_reason] : "unknown");
+  printf("  flags              %s%s\n",
+      h.flags & HANDOFF_FLAG_IMAGE_INVALID ? "image-invalid " : "",
+      h.flags & HANDOFF_FLAG_BUTTON_HELD ? "button-held" : "");
+  printf("  attempts           %u\n", h.attempts);
+  printf("  bytes received     %u\n", h.bytes_received);
+  printf("  sync/crc errors    %u / %u\n", h.sync_errors, h.crc_errors);
+  printf("  reset to jump      %u cycles\n", h.reset_to_jump_cycles);
+  printf("  startup            %u cycles\n", h.startup_cycles);
+  printf("  wait/receive/copy  %u / %u / %u ms (programming %u ms)\n",
+      h.wait_ms, h.receive_ms, h.copy_ms, h.program_ms);
+  printf("  image              %u bytes, crc 0x%08X", h.image_length, h.image_crc);
+  if (h.version >= 2) {
+    printf(", version %u", h.image_version);
+  }
+  printf("\n");
+  if (h.version >= 3 && h.audio_cycles_budget) {
+    printf("  audio interrupt    %u avg / %u max of %u cycles per sample at %u Hz"
+        " (%u%% load)\n",
+        h.audio_cycles_avg, h.audio_cycles_max, h.audio_cycles_budget, h.sample_rate,
+        100 * h.audio_cycles_avg / h.audio_cycles_budget);
+  }
+  if (h.version >= 4) {
+    printf("  audio overruns     %u\n", h.audio_overruns);
+  }
+  if (h.version >= 5 && h.core_clock_hz) {
+    printf("  core clock         %u MHz\n", h.core_clock_hz / 1000000);
+  }
+  if (h.version >= 6 && h.bytes_received) {
+    printf("  input gain         %+.1f dB\n", 1.5 * ((int)h.input_gain - 23));
+  }
+  if (h.version >= 7) {
+    printf("  symbols lost       %u\n", h.symbols_lost);
+  }
+  if (h.version >= 9 && h.decode_symbols) {
+    printf("  decode/store       %u avg / %u max cycles per symbol, %u symbols\n",
+        h.decode_cycles / h.decode_symbols, h.decode_cycles_max, h.decode_symbols);
+  }
+  if (h.version >= 10 && h.prefilter_cycles_avg) {
+    printf("  prefilter          %u avg / %u max of the audio interrupt cycles per sample\n",
+        h.prefilter_cycles_avg, h.prefilter_cycles_max);
+  }
+  printf("\n");
+  if (h.version >= 5) {
+    PrintClockBench(h);
+  }
+}
+
+static void PrintRing(const TelemetryRing& ring) {
+  uint32_t count = ring.attempts < TELEMETRY_NUM_ENTRIES
+      ? ring.attempts : TELEMETRY_NUM_ENTRIES;
+  uint32_t first = ring.attempts - count;
+  uint32_t results[TLM_NUM_RESULTS] = { 0 };
+  uint64_t ok_bytes = 0, ok_ms = 0;
+
+  printf("Update attempts: %u in total over %u boots into update mode, last %u shown\n\n",
+      ring.attempts, ring.boots, count);
+  printf("%6s %5s %9s %9s %8s %8s %7s %9s %6s %7s %7s  %s\n",
+      "#", "boot", "start ms", "dur ms", "bytes", "B/s", "packet", "symbols",
+      "level", "margin", "jitter", "result");
+
+  for (uint32_t n = first; n < ring.attempts; ++n) {
+    const TelemetryEntry& e = ring.entries[n % TELEMETRY_NUM_ENTRIES];
+    printf("%6u %5u %9u %9u %8u %8u %7u %9u %6u %6u%% %7.2f  %s\n",
+        n, e.boot, e.start_ms, e.duration_ms, e.bytes, e.bytes_per_s,
+        e.packet_index, e.symbols, e.level, e.margin, e.jitter / 16.0,
+        ResultName(e.result));
+    if (e.result < TLM_NUM_RESULTS) {
+      ++results[e.result];
+    }
+    if (e.result == TLM_OK) {
+      ok_bytes += e.bytes;
+      ok_ms += e.duration_ms;
+    }
+  }
+
+  printf("\nSummary:\n");
+  for (int r = 0; r < TLM_NUM_RESULTS; ++r) {
+    if (results[r]) {
+      printf("  %-16s %u\n", kResultNames[r], results[r]);
+    }
+  }
+  if (ok_ms) {
+    printf("  mean throughput of successful updates: %.0f B/s\n",
+        1000.0 * ok_bytes / ok_ms);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s bkpsram.bin\n", argv[0]);
+    return 1;
+  }
+
+  FILE* fp = fopen(argv[1], "rb");
+  if (!fp) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> dump;
+  uint8_t buffer[1024];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    dump.insert(dump.end(), buffer, buffer + n);
+  }
+  fclose(fp);
+
+  // Full backup SRAM dump, or just the ring?
+  size_t ring_offset = TELEMETRY_OFFSET;
+  uint32_t magic = 0;
+  if (dump.size() >= sizeof(magic)) {
+    memcpy(&magic, &dump[0], sizeof(magic));
+  }
+  if (magic == TELEMETRY_MAGIC) {
+    ring_offset = 0;
+  } else if (magic == HANDOFF_MAGIC && dump.size() >= sizeof(BootloaderHandoff)) {
+    BootloaderHandoff handoff;
+    memcpy(&handoff, &dump[0], sizeof(handoff));
+    PrintHandoff(handoff);
+  }
+
+  if (dump.size() < ring_offset + sizeof(TelemetryRing)) {
+    fprintf(stderr, "%s: too short for the telemetry ring\n", argv[1]);
+    return 1;
+  }
+  TelemetryRing ring;
+  memcpy(&ring, &dump[ring_offset], sizeof(ring));
+  if (ring.magic != TELEMETRY_MAGIC) {
+    fprintf(stderr, "No telemetry ring found (bad magic 0x%08X)\n", ring.magic);
+    return 1;
+  }
+  if (ring.version != TELEMETRY_VERSION || ring.entry_size != sizeof(TelemetryEntry)) {
+    fprintf(stderr, "Telemetry ring version %u (entry size %u), this tool reads version %u\n",
+        ring.version, ring.entry_size, TELEMETRY_VERSION);
+    return 1;
+  }
+  PrintRing(ring);
+  return 0;
+}
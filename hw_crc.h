@@ -0,0 +1,41 @@
+/*
+ * hw_crc.h - CRC-32 with the STM32 hardware CRC calculation unit
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef HW_CRC_H_
+#define HW_CRC_H_
+
+#include "stm32f4xx.h"
+
+// The CRC unit uses the CRC-32/MPEG-2 algorithm: polynomial 0x04C11DB7, initial value 0xFFFFFFFF,
+// fed one 32-bit word at a time, no bit reflection and no final XOR.
+// This is not the same as zlib's crc32(), which is what the packet decoder uses.
+
+void HWCRC_Init(void);
+uint32_t HWCRC_Calc(const uint32_t *data, uint32_t num_words);
+
+#endif /* HW_CRC_H_ */
@@ -0,0 +1,110 @@
+/*
+ * i2c_master.h - register level polled I2C master writes
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef I2C_MASTER_H_
+#define I2C_MASTER_H_
+
+#include "stm32f4xx.h"
+
+// Same as I2C_DeInit(), I2C_Init() and the polled write sequence the codec and LED driver
+// used (I2C_GenerateSTART(), I2C_CheckEvent()...), without the init struct and inlined.
+// Master mode, 7-bit addresses, ACK on, and the 2:1 duty cycle above 100kHz.
+// Each wait gives up after timeout polls and returns 1, leaving the bus as it is, as before.
+
+//PCLK1, from the current HCLK and the APB1 prescaler
+static inline uint32_t I2CMaster_PCLK1(void)
+{
+	uint32_t ppre1 = (RCC->CFGR & RCC_CFGR_PPRE1) >> 10;
+
+	return (ppre1 & 4) ? SystemCoreClock >> ((ppre1 & 3) + 1) : SystemCoreClock;
+}
+
+//The peripheral clock must be on. reset is its RCC_APB1Periph_x bit, which is also its RCC->APB1RSTR bit.
+static inline void I2CMaster_Init(I2C_TypeDef *i2c, uint32_t reset, uint8_t own_address, uint32_t speed)
+{
+	uint32_t pclk1 = I2CMaster_PCLK1();
+	uint16_t freq = pclk1 / 1000000;
+	uint16_t ccr;
+
+	RCC->APB1RSTR |= reset;
+	RCC->APB1RSTR &= ~reset;
+
+	i2c->CR2 = (i2c->CR2 & ~I2C_CR2_FREQ) | freq;
+	i2c->CR1 &= ~I2C_CR1_PE;
+
+	if (speed <= 100000) {
+		ccr = pclk1 / (speed << 1);
+		if (ccr < 4) ccr = 4;
+		i2c->TRISE = freq + 1;
+	} else {
+		ccr = pclk1 / (speed * 3);
+		if ((ccr & I2C_CCR_CCR) == 0) ccr |= 1;
+		ccr |= I2C_CCR_FS;
+		i2c->TRISE = (freq * 300) / 1000 + 1;
+	}
+	i2c->CCR = ccr;
+	i2c->CR1 |= I2C_CR1_PE;
+	i2c->CR1 |= I2C_CR1_ACK;
+
+	i2c->OAR1 = (1 << 14) | own_address; //bit 14 must be kept at 1
+}
+
+static inline uint32_t I2CMaster_WaitSR1(I2C_TypeDef *i2c, uint16_t flag, uint32_t timeout)
+{
+	while (!(i2c->SR1 & flag))
+		if (timeout-- == 0) return 1;
+	return 0;
+}
+
+//Waits for the bus, sends a START and the address (write)
+static inline uint32_t I2CMaster_Start(I2C_TypeDef *i2c, uint8_t address, uint32_t timeout, uint32_t busy_timeout)
+{
+	while (i2c->SR2 & I2C_SR2_BUSY)
+		if (busy_timeout-- == 0) return 1;
+
+	i2c->CR1 |= I2C_CR1_START;
+	if (I2CMaster_WaitSR1(i2c, I2C_SR1_SB, timeout)) return 1;
+
+	i2c->DR = address; //reading SR1 then writing DR clears SB
+	if (I2CMaster_WaitSR1(i2c, I2C_SR1_ADDR, timeout)) return 1;
+	(void)i2c->SR2; //reading SR1 then SR2 clears ADDR
+	return 0;
+}
+
+static inline uint32_t I2CMaster_Send(I2C_TypeDef *i2c, uint8_t data, uint32_t timeout)
+{
+	i2c->DR = data;
+	return I2CMaster_WaitSR1(i2c, I2C_SR1_TXE, timeout);
+}
+
+static inline void I2CMaster_Stop(I2C_TypeDef *i2c)
+{
+	i2c->CR1 |= I2C_CR1_STOP;
+}
+
+#endif /* I2C_MASTER_H_ */
@@ -29,6 +29,7 @@
 #include "i2s.h"
 #include "codec.h"
 #include "inouts.h"
+#include "ramfunc.h"
 
 #define codec_BUFF_LEN 8
 //#define codec_BUFF_LEN 128
@@ -38,7 +39,6 @@
 //Each audio frame is 2 channels (L/R), and each channel is 24bit which takes up two array elements
 //So we transfer 16 audio frames per interrupt
 
-DMA_InitTypeDef dma_tx, dma_rx;
 uint32_t txbuf, rxbuf;
 
 extern uint32_t g_error;
@@ -46,69 +46,41 @@ extern uint32_t g_error;
 volatile int16_t tx_buffer[codec_BUFF_LEN];
 volatile int16_t rx_buffer[codec_BUFF_LEN];
 
-DMA_InitTypeDef DMA_InitStructure, DMA_InitStructure2;
-void I2S_Block_Init(void)
+//What DMA_DeInit() and DMA_Init() did for both streams: circular, half words, memory increment,
+//high priority, direct mode (no FIFO). The buffer is set by I2S_Block_PlayRec().
+static void I2S_DMA_Init(DMA_Stream_TypeDef *stream, uint32_t cr, uint32_t fcr, uint32_t periph)
 {
-	NVIC_InitTypeDef NVIC_InitStructure;
+	stream->CR &= ~DMA_SxCR_EN;
+	while (stream->CR & DMA_SxCR_EN) {;}
 
-	/* Enable the DMA clock */
-	//RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOB | RCC_AHB1Periph_GPIOC, ENABLE);
+	stream->CR = cr | DMA_SxCR_PL_1 | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_CIRC;
+	stream->FCR = fcr;
+	stream->PAR = periph;
+}
 
+void I2S_Block_Init(void)
+{
+	/* Enable the DMA clock */
 	RCC_AHB1PeriphClockCmd(AUDIO_I2S_DMA_CLOCK, ENABLE);
 
-	/* Configure the TX DMA Stream */
-	DMA_Cmd(AUDIO_I2S_DMA_STREAM, DISABLE);
-	DMA_DeInit(AUDIO_I2S_DMA_STREAM);
-	/* Set the parameters to be configured */
-	DMA_InitStructure.DMA_Channel = AUDIO_I2S_DMA_CHANNEL;
-	DMA_InitStructure.DMA_PeripheralBaseAddr = AUDIO_I2S_DMA_DREG;
-	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)0;      /* This field will be configured in play function */
-	DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
-	DMA_InitStructure.DMA_BufferSize = (uint32_t)0xFFFE;      /* This field will be configured in play function */
-	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
-	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
-	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
-	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
-	DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
-	DMA_InitStructure.DMA_Priority = DMA_Priority_High;
-	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
-	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
-	DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
-	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
-	DMA_Init(AUDIO_I2S_DMA_STREAM, &DMA_InitStructure);
+	/* Configure the TX DMA Stream, memory to peripheral */
+	I2S_DMA_Init(AUDIO_I2S_DMA_STREAM, AUDIO_I2S_DMA_CHANNEL | DMA_SxCR_DIR_0, 0, AUDIO_I2S_DMA_DREG);
+	AUDIO_I2S_DMA_IFCR = AUDIO_I2S_DMA_IFCR_ALL;
 
 	/* Enable the I2S DMA request */
-	SPI_I2S_DMACmd(CODEC_I2S, SPI_I2S_DMAReq_Tx, ENABLE);
-
-	/* Configure the RX DMA Stream */
-	DMA_Cmd(AUDIO_I2S_EXT_DMA_STREAM, DISABLE);
-	DMA_DeInit(AUDIO_I2S_EXT_DMA_STREAM);
-
-	DMA_InitStructure2.DMA_Channel = AUDIO_I2S_EXT_DMA_CHANNEL;
-	DMA_InitStructure2.DMA_PeripheralBaseAddr = AUDIO_I2S_EXT_DMA_DREG;
-	DMA_InitStructure2.DMA_Memory0BaseAddr = (uint32_t)0;      /* This field will be configured in play function */
-	DMA_InitStructure2.DMA_DIR = DMA_DIR_PeripheralToMemory;
-	DMA_InitStructure2.DMA_BufferSize = (uint32_t)0xFFFE;      /* This field will be configured in play function */
-	DMA_InitStructure2.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
-	DMA_InitStructure2.DMA_MemoryInc = DMA_MemoryInc_Enable;
-	DMA_InitStructure2.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
-	DMA_InitStructure2.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
-	DMA_InitStructure2.DMA_Mode = DMA_Mode_Circular;
-	DMA_InitStructure2.DMA_Priority = DMA_Priority_High;
-	DMA_InitStructure2.DMA_FIFOMode = DMA_FIFOMode_Disable;
-	DMA_InitStructure2.DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
-	DMA_InitStructure2.DMA_MemoryBurst = DMA_MemoryBurst_Single;
-	DMA_InitStructure2.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
-	DMA_Init(AUDIO_I2S_EXT_DMA_STREAM, &DMA_InitStructure2);
-
-	/* Enable the Half & Complete DMA interrupts  */
-	DMA_ITConfig(AUDIO_I2S_EXT_DMA_STREAM, DMA_IT_TC | DMA_IT_HT | DMA_IT_FE | DMA_IT_TE | DMA_IT_DME, ENABLE);
+	CODEC_I2S->CR2 |= SPI_CR2_TXDMAEN;
+
+	/* Configure the RX DMA Stream, peripheral to memory, with the Half & Complete (and error) interrupts */
+	I2S_DMA_Init(AUDIO_I2S_EXT_DMA_STREAM,
+			AUDIO_I2S_EXT_DMA_CHANNEL | DMA_SxCR_TCIE | DMA_SxCR_HTIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE,
+			DMA_SxFCR_FEIE, AUDIO_I2S_EXT_DMA_DREG);
+	AUDIO_I2S_EXT_DMA_IFCR = AUDIO_I2S_EXT_DMA_IFCR_ALL;
 
 	/* I2S DMA IRQ Channel configuration */
 	NVIC_EnableIRQ(AUDIO_I2S_EXT_DMA_IRQ);
 
 	/* Enable the I2S DMA request */
-	SPI_I2S_DMACmd(CODEC_I2S_EXT, SPI_I2S_DMAReq_Rx, ENABLE);
+	CODEC_I2S_EXT->CR2 |= SPI_CR2_RXDMAEN;
 
 }
 
@@ -120,59 +92,56 @@ void I2S_Block_Init(void)
 //void I2S_Block_PlayRec(uint32_t txAddr, uint32_t rxAddr, uint32_t Size)
 void I2S_Block_PlayRec(void)
 {
-	uint32_t i;
 	uint32_t Size = codec_BUFF_LEN;
 
 	/* save for IRQ svc  */
 	txbuf = (uint32_t)&tx_buffer;
 	rxbuf = (uint32_t)&rx_buffer;
 
-	/* Configure the tx buffer address and size */
-	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)&tx_buffer;
-	DMA_InitStructure.DMA_BufferSize = (uint32_t)Size;
-
-	/* Configure the DMA Stream with the new parameters */
-	DMA_Init(AUDIO_I2S_DMA_STREAM, &DMA_InitStructure);
-
-	/* Configure the rx buffer address and size */
-	/* Again with the separate initstructure. Baroo?? */
-	DMA_InitStructure2.DMA_Memory0BaseAddr = (uint32_t)&rx_buffer;
-	DMA_InitStructure2.DMA_BufferSize = (uint32_t)Size;
-
-	/* Configure the DMA Stream with the new parameters */
-	DMA_Init(AUDIO_I2S_EXT_DMA_STREAM, &DMA_InitStructure2);
+	/* Configure the tx and rx buffer addresses and sizes (the streams are still disabled) */
+	AUDIO_I2S_DMA_STREAM->M0AR = (uint32_t)&tx_buffer;
+	AUDIO_I2S_DMA_STREAM->NDTR = Size;
+	AUDIO_I2S_EXT_DMA_STREAM->M0AR = (uint32_t)&rx_buffer;
+	AUDIO_I2S_EXT_DMA_STREAM->NDTR = Size;
 
 	/* Enable the I2S DMA Streams */
-	DMA_Cmd(AUDIO_I2S_DMA_STREAM, ENABLE);
-	DMA_Cmd(AUDIO_I2S_EXT_DMA_STREAM, ENABLE);
+	AUDIO_I2S_DMA_STREAM->CR |= DMA_SxCR_EN;
+	AUDIO_I2S_EXT_DMA_STREAM->CR |= DMA_SxCR_EN;
 
 	/* If the I2S peripheral is still not enabled, enable it */
-	if ((CODEC_I2S->I2SCFGR & 0x0400) == 0)
+	if ((CODEC_I2S->I2SCFGR & SPI_I2SCFGR_I2SE) == 0)
 	{
-		I2S_Cmd(CODEC_I2S, ENABLE);
+		CODEC_I2S->I2SCFGR |= SPI_I2SCFGR_I2SE;
 	}
-	if ((CODEC_I2S_EXT->I2SCFGR & 0x0400) == 0)
+	if ((CODEC_I2S_EXT->I2SCFGR & SPI_I2SCFGR_I2SE) == 0)
 	{
-		I2S_Cmd(CODEC_I2S_EXT, ENABLE);
+		CODEC_I2S_EXT->I2SCFGR |= SPI_I2SCFGR_I2SE;
 	}
 }
 
 
 void process_audio_block(int16_t *input, int16_t *output, uint16_t ht, uint16_t size);
 
+//Times both halves of the buffer were found done at once: the interrupt was held off
+//for longer than a half buffer, and a block of samples was lost
+volatile uint32_t audio_overruns;
+
 /**
   * @brief  This function handles I2S RX DMA block interrupt.
+  * Runs from SRAM, as does process_audio_block(), so it's not held off by flash erases.
   * @param  None
   * @retval none
   */
-void DMA1_Stream3_IRQHandler(void)
+RAMFUNC void DMA1_Stream3_IRQHandler(void)
 {
 	int16_t *src, *dst, sz;
-	uint8_t i;
+	uint32_t flags = AUDIO_I2S_EXT_DMA_ISR;
 
+	if ((flags & (AUDIO_I2S_EXT_DMA_ISR_TC | AUDIO_I2S_EXT_DMA_ISR_HT)) == (AUDIO_I2S_EXT_DMA_ISR_TC | AUDIO_I2S_EXT_DMA_ISR_HT))
+		audio_overruns++;
 
 	/* Transfer complete interrupt */
-	if (DMA_GetFlagStatus(AUDIO_I2S_EXT_DMA_STREAM, AUDIO_I2S_EXT_DMA_FLAG_TC) != RESET)
+	if (flags & AUDIO_I2S_EXT_DMA_ISR_TC)
 	{
 		/* Point to 2nd half of buffers */
 		sz = codec_BUFF_LEN/2;
@@ -184,11 +153,11 @@ void DMA1_Stream3_IRQHandler(void)
 
 
 		/* Clear the Interrupt flag */
-		DMA_ClearFlag(AUDIO_I2S_EXT_DMA_STREAM, AUDIO_I2S_EXT_DMA_FLAG_TC);
+		AUDIO_I2S_EXT_DMA_IFCR = AUDIO_I2S_EXT_DMA_ISR_TC;
 	}
 
 	/* Half Transfer complete interrupt */
-	if (DMA_GetFlagStatus(AUDIO_I2S_EXT_DMA_STREAM, AUDIO_I2S_EXT_DMA_FLAG_HT) != RESET)
+	if (flags & AUDIO_I2S_EXT_DMA_ISR_HT)
 	{
 		/* Point to 1st half of buffers */
 		sz = codec_BUFF_LEN/2;
@@ -199,7 +168,7 @@ void DMA1_Stream3_IRQHandler(void)
 		process_audio_block(src, dst, 1, sz);
 
 		/* Clear the Interrupt flag */
-		DMA_ClearFlag(AUDIO_I2S_EXT_DMA_STREAM, AUDIO_I2S_EXT_DMA_FLAG_HT);
+		AUDIO_I2S_EXT_DMA_IFCR = AUDIO_I2S_EXT_DMA_ISR_HT;
 	}
 
 }
@@ -36,5 +36,7 @@
 void I2S_Block_Init(void);
 void I2S_Block_PlayRec(void);
 
+extern volatile uint32_t audio_overruns;
+
 #endif
 
@@ -36,6 +36,7 @@
 #define ROTARY_RCC RCC_AHB1Periph_GPIOD
 
 #define ROTARY_SW_pin GPIO_Pin_9
+#define ROTARY_SW_pinnum 9
 #define ROTARY_SW (!(ROTARY_GPIO->IDR & ROTARY_SW_pin))
 
 #define LOCKBUT_RCC (RCC_AHB1Periph_GPIOD | RCC_AHB1Periph_GPIOG)
@@ -92,6 +93,7 @@
 
 
 void init_inouts(void);
+void init_rotary_sw(void);
 
 
 #endif /* INOUTS_H_ */
@@ -0,0 +1,184 @@
+/*
+ * led_ring.c - Framebuffer for the LED ring, sent to the PCA9685 drivers in the background
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include "led_ring.h"
+#include "pca9685_driver.h"
+
+//Give up on a transfer that hasn't finished after this many LEDRing_Flush() calls
+#define XFER_TIMEOUT_FLUSHES 10
+
+static uint16_t framebuffer[LEDRING_NUM_ELEMENTS];
+static volatile uint8_t dirty[LEDRING_NUM_ELEMENTS];
+
+static volatile uint8_t xfer_busy=0;
+static uint8_t xfer_element;
+static uint8_t xfer_addr;
+static uint8_t xfer_buf[5];
+static uint8_t xfer_pos;
+static uint8_t xfer_timeout;
+static uint8_t scan_pos=0;
+
+void LEDRing_Init(void){
+	uint8_t i;
+
+	for (i=0;i<LEDRING_NUM_ELEMENTS;i++){
+		framebuffer[i]=0;
+		dirty[i]=0;
+	}
+	xfer_busy=0;
+
+	//Below the audio DMA interrupt, above SysTick
+	NVIC_SetPriority(I2C1_EV_IRQn, 2);
+	NVIC_SetPriority(I2C1_ER_IRQn, 2);
+	NVIC_EnableIRQ(I2C1_EV_IRQn);
+	NVIC_EnableIRQ(I2C1_ER_IRQn);
+}
+
+void LEDRing_Set(uint8_t element, uint16_t brightness){
+	if (element >= LEDRING_NUM_ELEMENTS) return;
+
+	if (framebuffer[element] != brightness){
+		framebuffer[element] = brightness;
+		dirty[element] = 1;
+	}
+}
+
+void LEDRing_SetRGB(uint8_t led, uint16_t red, uint16_t green, uint16_t blue){
+	if (led < 25){
+		LEDRing_Set(led*3 + LEDRING_RED, red);
+		LEDRing_Set(led*3 + LEDRING_GREEN, green);
+		LEDRing_Set(led*3 + LEDRING_BLUE, blue);
+	} else if (led == 25){
+		//The last LED is spread over the 16th channel of drivers 2, 3 and 4, in reverse order
+		LEDRing_Set(75, blue);
+		LEDRing_Set(76, green);
+		LEDRing_Set(77, red);
+	}
+}
+
+void LEDRing_Clear(void){
+	uint8_t i;
+
+	for (i=0;i<LEDRING_NUM_ELEMENTS;i++)
+		LEDRing_Set(i, 0);
+}
+
+//Starts sending the next changed element, if there is one.
+//Only called when no transfer is running, so it never races with the I2C interrupts.
+static void start_next_element(void){
+	uint8_t i, element, driverAddr;
+	uint16_t brightness;
+
+	for (i=0;i<LEDRING_NUM_ELEMENTS;i++){
+		if (++scan_pos >= LEDRING_NUM_ELEMENTS) scan_pos=0;
+		if (dirty[scan_pos]) break;
+	}
+	if (i == LEDRING_NUM_ELEMENTS){
+		xfer_busy=0;
+		return;
+	}
+
+	xfer_element = scan_pos;
+	dirty[xfer_element] = 0;
+	brightness = framebuffer[xfer_element];
+
+	//Same mapping as LEDDriver_set_one_LED()
+	element = xfer_element;
+	if (element<=74){
+		driverAddr = (element/15);
+		element = element - (driverAddr * 15);
+	} else {
+		driverAddr = element - 73;
+		element = 15;
+	}
+
+	xfer_addr = PCA9685_I2C_BASE_ADDRESS | (driverAddr << 1);
+	xfer_buf[0] = PCA9685_LED0 + (element*4);
+	xfer_buf[1] = 0; //on-time = 0
+	xfer_buf[2] = 0;
+	xfer_buf[3] = brightness & 0xFF; //off-time = brightness
+	xfer_buf[4] = brightness >> 8;
+	xfer_pos = 0;
+	xfer_timeout = 0;
+	xfer_busy = 1;
+
+	LEDDRIVER_I2C->CR2 |= I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN | I2C_CR2_ITERREN;
+	LEDDRIVER_I2C->CR1 |= I2C_CR1_START;
+}
+
+static void abort_transfer(void){
+	LEDDRIVER_I2C->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN | I2C_CR2_ITERREN);
+	LEDDRIVER_I2C->CR1 |= I2C_CR1_STOP;
+	dirty[xfer_element] = 1; //try again later
+	xfer_busy = 0;
+}
+
+//Call this regularly (from SysTick)
+void LEDRing_Flush(void){
+	if (!xfer_busy)
+		start_next_element();
+
+	else if (++xfer_timeout > XFER_TIMEOUT_FLUSHES){
+		NVIC_DisableIRQ(I2C1_EV_IRQn);
+		abort_transfer();
+		NVIC_EnableIRQ(I2C1_EV_IRQn);
+	}
+}
+
+void I2C1_EV_IRQHandler(void){
+	uint16_t sr1 = LEDDRIVER_I2C->SR1;
+
+	if (sr1 & I2C_SR1_SB){
+		LEDDRIVER_I2C->DR = xfer_addr; //reading SR1 then writing DR clears SB
+
+	} else if (sr1 & I2C_SR1_ADDR){
+		(void)LEDDRIVER_I2C->SR2; //reading SR1 then SR2 clears ADDR
+		LEDDRIVER_I2C->DR = xfer_buf[xfer_pos++];
+
+	} else if (sr1 & I2C_SR1_TXE){
+		if (xfer_pos < sizeof(xfer_buf)){
+			LEDDRIVER_I2C->DR = xfer_buf[xfer_pos++];
+
+		} else if (sr1 & I2C_SR1_BTF){
+			//Last byte is out: stop, and go straight on to the next changed element
+			LEDDRIVER_I2C->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN | I2C_CR2_ITERREN);
+			LEDDRIVER_I2C->CR1 |= I2C_CR1_STOP;
+			while (LEDDRIVER_I2C->CR1 & I2C_CR1_STOP) {;} //a few us at 400kHz
+			start_next_element();
+
+		} else {
+			//Wait for BTF instead of getting a TXE interrupt on every cycle
+			LEDDRIVER_I2C->CR2 &= ~I2C_CR2_ITBUFEN;
+		}
+	}
+}
+
+void I2C1_ER_IRQHandler(void){
+	LEDDRIVER_I2C->SR1 &= ~(I2C_SR1_AF | I2C_SR1_ARLO | I2C_SR1_BERR | I2C_SR1_OVR);
+	abort_transfer();
+}
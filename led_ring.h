@@ -0,0 +1,55 @@
+/*
+ * led_ring.h - Framebuffer for the LED ring, sent to the PCA9685 drivers in the background
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef LED_RING_H_
+#define LED_RING_H_
+
+#include <stm32f4xx.h>
+
+// The 26 RGB LEDs (20 around the ring, then the 6 channel LEDs) are 78 elements on the
+// PCA9685 drivers, numbered the same way as LEDDriver_set_one_LED().
+//
+// LEDRing_Set*() only write to the framebuffer. Changed elements are sent one at a time with
+// interrupt-driven I2C, started by LEDRing_Flush(), so nothing waits on the I2C bus.
+// Once LEDRing_Init() is called, the blocking LEDDriver_* functions must not be used anymore.
+
+#define LEDRING_NUM_ELEMENTS	78
+#define LEDRING_NUM_RGB_LEDS	26
+#define LEDRING_NUM_RING_LEDS	20
+
+#define LEDRING_RED		0
+#define LEDRING_GREEN	1
+#define LEDRING_BLUE	2
+
+void LEDRing_Init(void);
+void LEDRing_Set(uint8_t element, uint16_t brightness);
+void LEDRing_SetRGB(uint8_t led, uint16_t red, uint16_t green, uint16_t blue);
+void LEDRing_Clear(void);
+void LEDRing_Flush(void);
+
+#endif /* LED_RING_H_ */
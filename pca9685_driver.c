@@ -29,6 +29,8 @@
  */
 
 #include <stm32f4xx.h>
+#include "pins.h"
+#include "i2c_master.h"
 //#include "stm32f4xx_gpio.h"
 //#include "stm32f4xx_i2c.h"
 //#include "stm32f4xx_spi.h"
@@ -44,48 +46,27 @@ do {							\
 } while (0)
 
 
-__IO uint32_t  LEDDriverTimeout = LEDDRIVER_LONG_TIMEOUT;
-
 void LEDDriver_GPIO_Init(void)
 {
-	GPIO_InitTypeDef GPIO_InitStructure;
-
 	/* Enable I2S and I2C GPIO clocks */
 	RCC_AHB1PeriphClockCmd(LEDDRIVER_I2C_GPIO_CLOCK, ENABLE);
 
 	/* LEDDRIVER_I2C SCL and SDA pins configuration -------------------------------------*/
-	GPIO_InitStructure.GPIO_Pin = LEDDRIVER_I2C_SCL_PIN | LEDDRIVER_I2C_SDA_PIN;
-	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
-	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_2MHz;
-	GPIO_InitStructure.GPIO_OType = GPIO_OType_OD;
-	GPIO_InitStructure.GPIO_PuPd  = GPIO_PuPd_NOPULL;
-	GPIO_Init(LEDDRIVER_I2C_GPIO, &GPIO_InitStructure);
+	Pins_Init(LEDDRIVER_I2C_GPIO, LEDDRIVER_I2C_SCL_PIN | LEDDRIVER_I2C_SDA_PIN, GPIO_Mode_AF, GPIO_OType_OD, GPIO_Speed_2MHz, GPIO_PuPd_NOPULL);
 
 	/* Connect pins to I2C peripheral */
-	GPIO_PinAFConfig(LEDDRIVER_I2C_GPIO, LEDDRIVER_I2S_SCL_PINSRC, LEDDRIVER_I2C_GPIO_AF);
-	GPIO_PinAFConfig(LEDDRIVER_I2C_GPIO, LEDDRIVER_I2S_SDA_PINSRC, LEDDRIVER_I2C_GPIO_AF);
+	Pins_SetAF(LEDDRIVER_I2C_GPIO, LEDDRIVER_I2S_SCL_PINSRC, LEDDRIVER_I2C_GPIO_AF);
+	Pins_SetAF(LEDDRIVER_I2C_GPIO, LEDDRIVER_I2S_SDA_PINSRC, LEDDRIVER_I2C_GPIO_AF);
 
 }
 
 void LEDDriver_I2C_Init(void)
 {
-	I2C_InitTypeDef I2C_InitStructure;
-
 	/* Enable the LEDDRIVER_I2C peripheral clock */
 	RCC_APB1PeriphClockCmd(LEDDRIVER_I2C_CLK, ENABLE);
 
-	/* LEDDRIVER_I2C peripheral configuration */
-	I2C_DeInit(LEDDRIVER_I2C);
-	I2C_InitStructure.I2C_Mode = I2C_Mode_I2C;
-	I2C_InitStructure.I2C_DutyCycle = I2C_DutyCycle_2;
-	I2C_InitStructure.I2C_OwnAddress1 = 0x34;
-	I2C_InitStructure.I2C_Ack = I2C_Ack_Enable;
-	I2C_InitStructure.I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
-	I2C_InitStructure.I2C_ClockSpeed = I2C1_SPEED;
-
-	/* Enable the I2C peripheral */
-	I2C_Cmd(LEDDRIVER_I2C, ENABLE);
-	I2C_Init(LEDDRIVER_I2C, &I2C_InitStructure);
+	/* LEDDRIVER_I2C peripheral configuration, and enable it */
+	I2CMaster_Init(LEDDRIVER_I2C, LEDDRIVER_I2C_CLK, 0x34, I2C1_SPEED);
 }
 
 
@@ -101,58 +82,20 @@ uint32_t LEDDriver_writeregister(uint8_t driverAddr, uint8_t RegisterAddr, uint8
 	driverAddr = PCA9685_I2C_BASE_ADDRESS | (driverAddr << 1);
 	//driverAddr = 0b10000000;
 
-	/*!< While the bus is busy */
-	LEDDriverTimeout = LEDDRIVER_LONG_TIMEOUT;
-	while(I2C_GetFlagStatus(LEDDRIVER_I2C, I2C_FLAG_BUSY))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
-
-	/* Start the config sequence */
-	I2C_GenerateSTART(LEDDRIVER_I2C, ENABLE);
-
-	LEDDriverTimeout = LEDDRIVER_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(LEDDRIVER_I2C, I2C_EVENT_MASTER_MODE_SELECT))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
-
-	/* Transmit the slave address */
-	I2C_Send7bitAddress(LEDDRIVER_I2C, driverAddr, I2C_Direction_Transmitter);
-
-	LEDDriverTimeout = LEDDRIVER_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(LEDDRIVER_I2C, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
-
-	/* Transmit the address for write operation */
-	I2C_SendData(LEDDRIVER_I2C, RegisterAddr);
-
-	/* Test on EV8 and clear it */
-	LEDDriverTimeout = LEDDRIVER_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(LEDDRIVER_I2C, I2C_EVENT_MASTER_BYTE_TRANSMITTING))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
+	/* Start the config sequence, transmit the slave address and the address for write operation */
+	if (I2CMaster_Start(LEDDRIVER_I2C, driverAddr, LEDDRIVER_FLAG_TIMEOUT, LEDDRIVER_LONG_TIMEOUT)
+			|| I2CMaster_Send(LEDDRIVER_I2C, RegisterAddr, LEDDRIVER_FLAG_TIMEOUT))
+		return LEDDRIVER_TIMEOUT_UserCallback();
 
 	/* Prepare the register value to be sent */
-	I2C_SendData(LEDDRIVER_I2C, RegisterValue);
+	LEDDRIVER_I2C->DR = RegisterValue;
 
 	/*!< Wait till all data have been physically transferred on the bus */
-	LEDDriverTimeout = LEDDRIVER_LONG_TIMEOUT;
-	while(!I2C_GetFlagStatus(LEDDRIVER_I2C, I2C_FLAG_BTF))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
+	if (I2CMaster_WaitSR1(LEDDRIVER_I2C, I2C_SR1_BTF, LEDDRIVER_LONG_TIMEOUT))
+		return LEDDRIVER_TIMEOUT_UserCallback();
 
 	/* End the configuration sequence */
-	I2C_GenerateSTOP(LEDDRIVER_I2C, ENABLE);
+	I2CMaster_Stop(LEDDRIVER_I2C);
 
 	/* Return the verifying value: 0 (Passed) or 1 (Failed) */
 	return result;
@@ -164,33 +107,9 @@ inline uint32_t LEDDriver_startxfer(uint8_t driverAddr){
 
 	driverAddr = PCA9685_I2C_BASE_ADDRESS | (driverAddr << 1);
 
-	/*!< While the bus is busy */
-	LEDDriverTimeout = LEDDRIVER_LONG_TIMEOUT;
-	while(I2C_GetFlagStatus(LEDDRIVER_I2C, I2C_FLAG_BUSY))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
-
-	/* Start the config sequence */
-	I2C_GenerateSTART(LEDDRIVER_I2C, ENABLE);
-
-	LEDDriverTimeout = LEDDRIVER_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(LEDDRIVER_I2C, I2C_EVENT_MASTER_MODE_SELECT))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
-
-	/* Transmit the slave address */
-	I2C_Send7bitAddress(LEDDRIVER_I2C, driverAddr, I2C_Direction_Transmitter);
-
-	LEDDriverTimeout = LEDDRIVER_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(LEDDRIVER_I2C, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
+	/* Start the config sequence and transmit the slave address */
+	if (I2CMaster_Start(LEDDRIVER_I2C, driverAddr, LEDDRIVER_FLAG_TIMEOUT, LEDDRIVER_LONG_TIMEOUT))
+		return LEDDRIVER_TIMEOUT_UserCallback();
 
 	return result;
 }
@@ -199,21 +118,16 @@ inline uint32_t LEDDriver_senddata(uint8_t data){
 	uint32_t result=0;
 
 	/* Transmit the data for write operation */
-	I2C_SendData(LEDDRIVER_I2C, data);
+	if (I2CMaster_Send(LEDDRIVER_I2C, data, LEDDRIVER_FLAG_TIMEOUT))
+		return LEDDRIVER_TIMEOUT_UserCallback();
 
-	LEDDriverTimeout = LEDDRIVER_FLAG_TIMEOUT;
-	while (!I2C_CheckEvent(LEDDRIVER_I2C, I2C_EVENT_MASTER_BYTE_TRANSMITTING))
-	{
-		if((LEDDriverTimeout--) == 0)
-			return LEDDRIVER_TIMEOUT_UserCallback();
-	}
 	return result;
 
 }
 
 inline void LEDDriver_endxfer(void){
 	/* End the configuration sequence */
-	I2C_GenerateSTOP(LEDDRIVER_I2C, ENABLE);
+	I2CMaster_Stop(LEDDRIVER_I2C);
 
 }
 
@@ -0,0 +1,62 @@
+/*
+ * pins.h - register level GPIO setup
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef PINS_H_
+#define PINS_H_
+
+#include "stm32f4xx.h"
+
+// Same as GPIO_Init() and GPIO_PinAFConfig(), without the init struct, and inlined:
+// every call site passes constants, so each one only leaves a few register writes.
+// Takes the StdPeriph constants (GPIO_Mode_OUT, GPIO_OType_PP, GPIO_Speed_2MHz, GPIO_PuPd_UP...)
+
+static inline void Pins_Init(GPIO_TypeDef *port, uint16_t pins, uint32_t mode, uint32_t otype, uint32_t speed, uint32_t pupd)
+{
+	uint32_t pin;
+
+	for (pin = 0; pin < 16; pin++) {
+		if (!(pins & (1 << pin)))
+			continue;
+
+		if (mode == GPIO_Mode_OUT || mode == GPIO_Mode_AF) {
+			port->OSPEEDR = (port->OSPEEDR & ~(3UL << (pin * 2))) | (speed << (pin * 2));
+			port->OTYPER = (port->OTYPER & ~(1UL << pin)) | (otype << pin);
+		}
+		port->MODER = (port->MODER & ~(3UL << (pin * 2))) | (mode << (pin * 2));
+		port->PUPDR = (port->PUPDR & ~(3UL << (pin * 2))) | (pupd << (pin * 2));
+	}
+}
+
+static inline void Pins_SetAF(GPIO_TypeDef *port, uint8_t pin_source, uint8_t af)
+{
+	uint32_t shift = (pin_source & 7) * 4;
+
+	port->AFR[pin_source >> 3] = (port->AFR[pin_source >> 3] & ~(0xFUL << shift)) | ((uint32_t)af << shift);
+}
+
+#endif /* PINS_H_ */
@@ -0,0 +1,65 @@
+/*
+ * ramfunc.h - placing code in SRAM
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef RAMFUNC_H_
+#define RAMFUNC_H_
+
+// Functions marked RAMFUNC go in .ramtext, which the linker script puts in .data:
+// they're copied to SRAM at startup along with the initialized variables.
+//
+// The audio interrupt and everything it calls are placed there, so it keeps running
+// while the flash is busy with an erase or a write (any fetch from flash stalls until then).
+// The packet decoder and the main loop are still in flash and wait for the erase: the
+// symbols demodulated meanwhile are queued in the demodulator's ring, which is sized for
+// the longest erase (fsk/demodulator.h).
+// Code running from SRAM must not call or read anything that is still in flash,
+// including const tables. long_call makes calls go through a register, so there are
+// no veneers (which would be placed in flash) between SRAM and flash code.
+//
+// With make HYBRID=1, RAMFUNC code is also optimized for speed (-O3) instead of size, and
+// HOTFUNC code (the packet decoder and the CRC loop, which run in the main loop) is moved
+// to SRAM as well. Otherwise HOTFUNC stays in flash.
+//
+// On the host (the fsk/ code is shared with host/fsk_encoder.cc), these do nothing.
+
+#ifndef HYBRID
+#define HYBRID 0
+#endif
+
+#if defined(__arm__) && HYBRID
+#define RAMFUNC __attribute__((section(".ramtext"), long_call, optimize("O3")))
+#define HOTFUNC RAMFUNC
+#elif defined(__arm__)
+#define RAMFUNC __attribute__((section(".ramtext"), long_call))
+#define HOTFUNC
+#else
+#define RAMFUNC
+#define HOTFUNC
+#endif
+
+#endif /* RAMFUNC_H_ */
@@ -65,6 +65,18 @@ defined in linker script */
   .type  Reset_Handler, %function
 Reset_Handler:  
 
+/* Start the DWT cycle counter first thing, so main() can time reset-to-jump */
+  ldr  r0, =0xE000EDFC
+  ldr  r1, [r0]
+  orr  r1, r1, #0x01000000
+  str  r1, [r0]
+  ldr  r0, =0xE0001000
+  movs  r1, #0
+  str  r1, [r0, #4]
+  ldr  r1, [r0]
+  orr  r1, r1, #1
+  str  r1, [r0]
+
 /* Copy the data segment initializers from flash to SRAM */  
   movs  r1, #0
   b  LoopCopyDataInit
@@ -93,6 +105,18 @@ LoopFillZerobss:
   cmp  r2, r3
   bcc  FillZerobss
 
+/* Zero fill the .ccmbss section (CCM RAM) */
+  ldr  r2, =_sccmbss
+  b  LoopFillZeroccmbss
+FillZeroccmbss:
+  movs  r3, #0
+  str  r3, [r2], #4
+
+LoopFillZeroccmbss:
+  ldr  r3, = _eccmbss
+  cmp  r2, r3
+  bcc  FillZeroccmbss
+
 /* Call the clock system intitialization function.*/
   bl  SystemInit   
 /* Call the application's entry point.*/
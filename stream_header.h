@@ -0,0 +1,81 @@
+/*
+ * stream_header.h - Header packet at the start of an update stream
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef STREAM_HEADER_H_
+#define STREAM_HEADER_H_
+
+#include <stdint.h>
+
+// The first packet of an update stream can be a header describing the image that follows,
+// so a wrong or truncated file is rejected in the first second instead of at the end.
+// It's followed by a gap like the one after each page, which the bootloader uses to erase
+// the first receive sector. Streams without a header are still accepted.
+//
+// The CRCs are the ones the STM32 CRC unit computes (CRC-32/MPEG-2 over little-endian words),
+// so image_crc can be compared with the record of the installed image.
+//
+// This header is also compiled into host/fsk_encoder.cc, so it must only use plain C types.
+
+#define STREAM_HEADER_MAGIC		0x53524D53	/* "SMRS" */
+#define STREAM_HEADER_VERSION	2
+
+#define STREAM_TARGET_SMR		0x00524D53	/* "SMR" */
+
+#define STREAM_FLAG_COMPRESSED	(1 << 0)
+#define STREAM_FLAG_DELTA		(1 << 1)
+#define STREAM_FLAG_SPARSE		(1 << 2)
+#define STREAM_FLAG_STEREO		(1 << 3)
+#define STREAM_SUPPORTED_FLAGS	(STREAM_FLAG_SPARSE | STREAM_FLAG_STEREO)
+
+// With STREAM_FLAG_SPARSE, the data after the header is a list of records instead of the image:
+// a word with the offset from the load address, a word with the length in bytes, then the data.
+// Offsets and lengths are multiples of 4, and the records are in increasing order.
+// An offset of STREAM_SPARSE_END ends the list. Anything not covered by a record is 0xFF.
+#define STREAM_SPARSE_END		0xFFFFFFFF
+
+// With STREAM_FLAG_STEREO, the header is on the left channel (the right one is blank), then the
+// packets alternate between the left (even) and right (odd) channels. Each channel carries half
+// of every page, and the pages end at the same time on both, before the gap.
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;				/* sizeof(StreamHeader) */
+	uint32_t target_id;
+	uint32_t image_version;		/* Set by whoever makes the file, only reported */
+	uint32_t length;			/* Image length in bytes, a multiple of 4 */
+	uint32_t load_address;		/* Where the image is linked to run */
+	uint32_t flags;
+	uint32_t image_crc;			/* Of length bytes */
+	uint32_t stream_length;		/* Bytes of data sent after the header: length, or less for a sparse image */
+	uint32_t header_crc;		/* Of all the words above */
+} StreamHeader;
+
+#define STREAM_HEADER_CRC_WORDS	((sizeof(StreamHeader) - 4) / 4)
+
+#endif /* STREAM_HEADER_H_ */
@@ -42,7 +42,7 @@ void System::Init(bool application) {
 }
 
 void System::StartTimers() {
-	SysTick_Config(F_CPU / 1000);
+	SysTick_Config(SystemCoreClock / 1000);
 }
 
 }  
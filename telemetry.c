@@ -0,0 +1,106 @@
+/*
+ * telemetry.c - History of update attempts, kept in backup SRAM
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include "stm32f4xx.h"
+#include "telemetry.h"
+#include "backup_sram.h"
+
+static volatile TelemetryEntry *current = 0;
+
+void Telemetry_Init(void){
+	volatile TelemetryRing *ring = TELEMETRY;
+	uint32_t timeout = 0x10000;
+	uint32_t i;
+
+	init_backup_sram();
+
+	//Keep the backup SRAM powered from VBAT when the module is off
+	PWR->CSR |= PWR_CSR_BRE;
+	while (!(PWR->CSR & PWR_CSR_BRR) && timeout--) {;}
+
+	if (ring->magic != TELEMETRY_MAGIC || ring->version != TELEMETRY_VERSION || ring->entry_size != sizeof(TelemetryEntry)){
+		ring->magic = TELEMETRY_MAGIC;
+		ring->version = TELEMETRY_VERSION;
+		ring->entry_size = sizeof(TelemetryEntry);
+		ring->boots = 0;
+		ring->attempts = 0;
+		for (i = 0; i < sizeof(ring->entries) / 4; i++)
+			((volatile uint32_t *)ring->entries)[i] = 0;
+	}
+	ring->boots++;
+	current = 0;
+}
+
+void Telemetry_Begin(uint32_t now_ms){
+	volatile TelemetryRing *ring = TELEMETRY;
+
+	current = &ring->entries[ring->attempts % TELEMETRY_NUM_ENTRIES];
+	ring->attempts++;
+
+	current->boot = ring->boots;
+	current->start_ms = now_ms;
+	current->duration_ms = 0;
+	current->bytes = 0;
+	current->bytes_per_s = 0;
+	current->result = TLM_IN_PROGRESS;
+	current->packet_index = 0;
+	current->symbols = 0;
+	current->level = 0;
+	current->margin = 0;
+	current->jitter = 0;
+}
+
+void Telemetry_Update(uint32_t now_ms, uint16_t packet_index, uint32_t bytes, uint32_t symbols){
+	if (!current) return;
+
+	current->duration_ms = now_ms - current->start_ms;
+	current->bytes = bytes;
+	current->bytes_per_s = current->duration_ms ? (bytes * 1000) / current->duration_ms : 0;	//no overflow below 4MB
+	current->packet_index = packet_index;
+	current->symbols = symbols;
+}
+
+void Telemetry_Link(uint16_t level, uint8_t margin, uint8_t jitter){
+	if (!current) return;
+
+	current->level = level;
+	current->margin = margin;
+	current->jitter = jitter;
+}
+
+void Telemetry_End(uint32_t now_ms, uint16_t result){
+	if (!current) return;
+
+	current->duration_ms = now_ms - current->start_ms;
+	current->result = result;
+	current = 0;
+}
+
+uint8_t Telemetry_InProgress(void){
+	return current ? 1 : 0;
+}
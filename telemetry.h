@@ -0,0 +1,96 @@
+/*
+ * telemetry.h - History of update attempts, kept in backup SRAM
+ *
+ * Copyright 2026 The smr-bootloader contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * See http://creativecommons.org/licenses/MIT/ for more information.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+// A fixed-size ring of the last TELEMETRY_NUM_ENTRIES update attempts.
+// An entry is written when an attempt starts and updated after every block, so an attempt
+// cut short by a reset or power loss is still there (with result TLM_IN_PROGRESS).
+//
+// To read it, dump the backup SRAM with gdb (see dump-bkpsram in .gdbinit) and run:
+//	make host-tools && build/host/telemetry_report build/bkpsram.bin
+//
+// This header is also compiled into the host tool, so it must only use plain C types.
+
+#define TELEMETRY_OFFSET		0x100
+#define TELEMETRY_ADDRESS		(0x40024000 + TELEMETRY_OFFSET)
+#define TELEMETRY				((volatile TelemetryRing *)TELEMETRY_ADDRESS)
+#define TELEMETRY_MAGIC			0x544D5253	/* "SRMT" */
+#define TELEMETRY_VERSION		2
+#define TELEMETRY_NUM_ENTRIES	32
+
+enum TelemetryResult {
+	TLM_IN_PROGRESS			= 0,
+	TLM_OK					= 1,
+	TLM_SYNC_ERROR			= 2,
+	TLM_CRC_ERROR			= 3,
+	TLM_IMAGE_TOO_LARGE		= 4,
+	TLM_VERIFY_FAILED		= 5,
+	TLM_BAD_HEADER			= 6,
+	TLM_WRONG_TARGET		= 7,
+	TLM_TRUNCATED			= 8,
+	TLM_ALREADY_INSTALLED	= 9,
+	TLM_BAD_RECORD			= 10,
+
+	TLM_NUM_RESULTS
+};
+
+typedef struct {
+	uint32_t boot;				/* TelemetryRing.boots when the attempt was made */
+	uint32_t start_ms;			/* SysTick ms since update mode was entered */
+	uint32_t duration_ms;
+	uint32_t bytes;				/* Data bytes received */
+	uint32_t bytes_per_s;
+	uint16_t result;			/* TelemetryResult */
+	uint16_t packet_index;		/* Packets received before the error (or in total) */
+	uint32_t symbols;			/* Demodulator symbols processed */
+	uint16_t level;				/* Slicer input peak envelope, in ADC counts */
+	uint8_t margin;				/* Symbol decision margin, % of the ideal */
+	uint8_t jitter;				/* Mean run length error, 1/16 samples */
+} TelemetryEntry;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entry_size;		/* sizeof(TelemetryEntry) */
+	uint32_t boots;				/* Times update mode was entered */
+	uint32_t attempts;			/* Entries ever written, the next one goes to entries[attempts % TELEMETRY_NUM_ENTRIES] */
+	TelemetryEntry entries[TELEMETRY_NUM_ENTRIES];
+} TelemetryRing;
+
+void Telemetry_Init(void);
+void Telemetry_Begin(uint32_t now_ms);
+void Telemetry_Update(uint32_t now_ms, uint16_t packet_index, uint32_t bytes, uint32_t symbols);
+void Telemetry_Link(uint16_t level, uint8_t margin, uint8_t jitter);
+void Telemetry_End(uint32_t now_ms, uint16_t result);
+uint8_t Telemetry_InProgress(void);
+
+#endif /* TELEMETRY_H_ */